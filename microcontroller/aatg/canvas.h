@@ -0,0 +1,167 @@
+ /**
+  * File:   canvas.h
+  *
+  * Description:
+  * 	32x100 pixel canvas on the 20x4 character display, each character being 8 pixel rows of 5.
+  * 	Coordinates are those of breakout.c: x runs down the display across its 4 rows of 8 pixels,
+  * 	y runs along the display across its 20 columns of 5 pixels.
+  * 	The pixels are kept as a bitplane, a byte per display row for each y, 400 bytes, and a byte
+  * 	always belongs to a single character, so changing pixels marks just that character dirty.
+  * 	'canvas_render();' turns the dirty characters into characters in lcdbuf.h: blank ones become
+  * 	spaces, full ones the display's full block and the rest custom characters from glyphcache.h.
+  * 	If a frame needs more than the 8 custom characters, the rest are shown as a space or a full
+  * 	block, whichever is closer, and stay dirty to be tried again on the next render.
+  *
+  * Usage:
+  * 	Call 'lcdbuf_init();' and 'canvas_init();'. Draw with 'canvas_fill(x,y,w,h,on);' and 'canvas_set(x,y,on);',
+  * 	later drawing is composited over earlier. Call 'canvas_render();' and then 'lcdbuf_flush();' to show it.
+  * 	A typical frame is 'canvas_clear();', then drawing everything, as only characters that end up
+  * 	different cost anything on the display.
+  * 	Custom characters are loaded with the blocking 'lcd_set_char', so do not use it with lcdqueue.h.
+  *
+  */
+
+#ifndef __AATG_CANVAS__
+#define __AATG_CANVAS__
+
+#include <avr/io.h>
+
+#include "lcdbuf.h"
+#include "glyphcache.h"
+
+#define CANVAS_WIDTH 32			// x, down the display
+#define CANVAS_HEIGHT 100		// y, along the display
+#define CANVAS_CHARW 8			// pixels of x per character
+#define CANVAS_CHARH 5			// pixels of y per character
+#define CANVAS_FULL 0xFF		// the display's full block character
+
+void canvas_init();											// Clears the canvas, expects the lcdbuf.h buffer to be blank
+void canvas_clear();										// Turns every pixel off
+void canvas_set(int x, int y, bool on);						// Sets one pixel
+bool canvas_get(int x, int y);								// Pixel at (x,y), off outside the canvas
+void canvas_fill(int x, int y, int w, int h, bool on);		// Sets a rectangle, clipped to the canvas
+unsigned char canvas_render();								// Updates the changed characters in lcdbuf.h, returns how many fell back
+
+void _canvas_touch(unsigned char y, unsigned char row, unsigned char bits);
+bool _canvas_char(unsigned char col, unsigned char row, char* c);
+char _canvas_closest(unsigned char col, unsigned char row);
+
+unsigned char _canvas_bits[CANVAS_HEIGHT][LCDBUF_ROWS];	// bit x%8 of [y][x/8]
+unsigned char _canvas_dirty[(LCDBUF_CELLS + 7)/8];		// bit per character, col*LCDBUF_ROWS + row
+
+
+void canvas_init() {
+	unsigned char y, row;
+	for(y = 0; y < CANVAS_HEIGHT; y++)
+		for(row = 0; row < LCDBUF_ROWS; row++)
+			_canvas_bits[y][row] = 0;
+	for(y = 0; y < sizeof(_canvas_dirty); y++)
+		_canvas_dirty[y] = 0;
+}
+
+void canvas_clear() {
+	unsigned char y, row;
+	for(y = 0; y < CANVAS_HEIGHT; y++)
+		for(row = 0; row < LCDBUF_ROWS; row++)
+			if(_canvas_bits[y][row])
+				_canvas_touch(y, row, 0);
+}
+
+void canvas_set(int x, int y, bool on) {
+	canvas_fill(x, y, 1, 1, on);
+}
+
+bool canvas_get(int x, int y) {
+	if(x < 0 || x >= CANVAS_WIDTH || y < 0 || y >= CANVAS_HEIGHT)
+		return false;
+	return (_canvas_bits[y][x/CANVAS_CHARW] >> (x%CANVAS_CHARW)) & 1;
+}
+
+void canvas_fill(int x, int y, int w, int h, bool on) {
+	unsigned char row, lo, hi, mask;
+	int j;
+	if(x < 0) { w += x; x = 0; }
+	if(y < 0) { h += y; y = 0; }
+	if(x + w > CANVAS_WIDTH)  w = CANVAS_WIDTH - x;
+	if(y + h > CANVAS_HEIGHT) h = CANVAS_HEIGHT - y;
+	if(w <= 0 || h <= 0)
+		return;
+	// a mask per display row, then one byte per y
+	for(row = x/CANVAS_CHARW; row <= (x + w - 1)/CANVAS_CHARW; row++) {
+		lo = x > row*CANVAS_CHARW ? x - row*CANVAS_CHARW : 0;
+		hi = x + w < (row + 1)*CANVAS_CHARW ? x + w - row*CANVAS_CHARW : CANVAS_CHARW;
+		mask = (unsigned char)(0xFF << lo) & (0xFF >> (CANVAS_CHARW - hi));
+		for(j = y; j < y + h; j++)
+			_canvas_touch(j, row, on ? _canvas_bits[j][row] | mask : _canvas_bits[j][row] & ~mask);
+	}
+}
+
+unsigned char canvas_render() {
+	unsigned char col, row, n;
+	unsigned char fallbacks = 0;
+	char c;
+	// characters left alone keep their custom characters
+	glyphcache_frame();
+	for(col = 0, n = 0; col < LCDBUF_COLS; col++)
+		for(row = 0; row < LCDBUF_ROWS; row++, n++)
+			if(!(_canvas_dirty[n/8] & (1<<(n%8))))
+				glyphcache_keep(lcdbuf_get(col, row));
+
+	for(col = 0, n = 0; col < LCDBUF_COLS; col++) {
+		for(row = 0; row < LCDBUF_ROWS; row++, n++) {
+			if(!(_canvas_dirty[n/8] & (1<<(n%8))))
+				continue;
+			if(_canvas_char(col, row, &c)) {
+				_canvas_dirty[n/8] &= ~(1<<(n%8));
+			} else {
+				c = _canvas_closest(col, row); // stays dirty, tried again on the next render
+				fallbacks++;
+			}
+			lcdbuf_set(col, row, c);
+		}
+	}
+	return fallbacks;
+}
+
+// stores the byte for (y,row) and marks its character dirty if it changed
+void _canvas_touch(unsigned char y, unsigned char row, unsigned char bits) {
+	unsigned char n;
+	if(_canvas_bits[y][row] == bits)
+		return;
+	_canvas_bits[y][row] = bits;
+	n = (y/CANVAS_CHARH)*LCDBUF_ROWS + row;
+	_canvas_dirty[n/8] |= 1<<(n%8);
+}
+
+// the character showing the pixels at (col,row), false if it needs a custom character and none was free
+bool _canvas_char(unsigned char col, unsigned char row, char* c) {
+	unsigned char glyph[GLYPHCACHE_ROWS] = {0};
+	unsigned char k, r, bits, any = 0, all = 0xFF;
+	for(k = 0; k < CANVAS_CHARH; k++) {
+		bits = _canvas_bits[col*CANVAS_CHARH + k][row];
+		any |= bits;
+		all &= bits;
+		// column k of the character is bit 4-k of every glyph row
+		for(r = 0; r < GLYPHCACHE_ROWS; r++)
+			if(bits & (1<<r))
+				glyph[r] |= 0x10 >> k;
+	}
+	if(!any)
+		*c = ' ';
+	else if(all == 0xFF)
+		*c = CANVAS_FULL;
+	else if((*c = glyphcache_get(glyph)) == (char)GLYPHCACHE_NONE)
+		return false;
+	return true;
+}
+
+// a space or a full block, whichever has more pixels in common with (col,row)
+char _canvas_closest(unsigned char col, unsigned char row) {
+	unsigned char k, bits, on = 0;
+	for(k = 0; k < CANVAS_CHARH; k++)
+		for(bits = _canvas_bits[col*CANVAS_CHARH + k][row]; bits; bits &= bits - 1)
+			on++;
+	return on*2 >= CANVAS_CHARW*CANVAS_CHARH ? CANVAS_FULL : ' ';
+}
+
+#endif
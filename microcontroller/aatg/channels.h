@@ -0,0 +1,369 @@
+ /**
+  * File:   channels.h
+  *
+  * Description:
+  * 	Table driven sensor channels. Each channel is described by a Channel entry
+  * 	stored in flash, holding its name, where its value comes from, how to convert
+  * 	and filter it and how often to report it. Sampling, telemetry and channel
+  * 	queries all run off the table, so adding a sensor is a one line change.
+  *
+  * Usage:
+  * 	Declare a table with 'const Channel table[] PROGMEM = {...};' and pass it to
+  * 	'channels_init(table, n);', channels past CHANNELS_MAX are left out.
+  * 	Call 'channels_sample(now);' as often as channels should be sampled, 'channels_value(i)' to get the latest value and 'channels_report(n);' to print
+  * 	the channels due in report period n as "<name>:<mean>,<min>,<max>,<count>" lines.
+  * 	Statistics cover every sample taken since the channel was last reported, so sampling
+  * 	and reporting rates are independent.
+  * 	'channels_sample(now);' may run from an interrupt, e.g. the clock tick, so sampling keeps its pace
+  * 	while the main loop is busy printing. The other functions take what they share with it with
+  * 	interrupts disabled, a channel at a time, and print with interrupts enabled.
+  *
+  * 	value = raw*mul/div + offset + trim, then low pass filtered if filter > 0:
+  * 	filtered += (value - filtered) / 2^filter
+  * 	The trim is set at run time with 'channels_set_trim(i, trim);', e.g. from a calibration stored in EEPROM.
+  *
+  * 	Each channel can have one trigger rule, set with 'channels_set_rule(i, type, level, hysteresis);'.
+  * 	Rules are checked on every sample and a match queues an event, printed as "!<name>:<value>,<now>"
+  * 	with the value and time of the sample that triggered it, however long the line was busy before it went out,
+  * 	by 'channels_report_events();', one event per call, call it before the routine report so events go out
+  * 	ahead of telemetry.
+  * 		CH_RULE_ABOVE	value rises above level, re-armed when it falls below level - hysteresis
+  * 		CH_RULE_BELOW	value falls below level, re-armed when it rises above level + hysteresis
+  * 		CH_RULE_DELTA	value moved level or more since it was last reported, level must be above 0
+  *
+  * 	Delta mode, enabled with 'channels_set_keyframe_interval(n);' for n > 0, cuts telemetry size:
+  * 	every n'th report is a keyframe, a "K1:<n>,<name>,<name>,..." header naming the reported
+  * 	channels in field order followed by the usual full lines. The reports in between are a single
+  * 	"~<delta>,<delta>,..." line holding the change of each channel's mean since it was last sent,
+  * 	with empty fields for channels that did not change or are not due, and trailing empty fields dropped.
+  */
+
+#ifndef __AATG_CHANNELS__
+#define __AATG_CHANNELS__
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+
+#include "adc.h"
+#include "essentials.h"
+
+// state is kept per channel in RAM, so this matches the table in main.c, define it before including this file for a longer table
+#ifndef CHANNELS_MAX
+#define CHANNELS_MAX 8
+#endif
+
+// channel sources
+#define CH_SRC_ADC		0	// ADC input, pin selects the input
+#define CH_SRC_VAR		1	// int variable in RAM, e.g. a servo setpoint
+#define CH_SRC_DERIVED	2	// value computed by a function
+
+// trigger rule types
+#define CH_RULE_NONE	0
+#define CH_RULE_ABOVE	1
+#define CH_RULE_BELOW	2
+#define CH_RULE_DELTA	3
+
+typedef int (*pChannelFunc)(void);
+
+typedef struct ChannelRule {
+	unsigned char type;
+	unsigned char armed;
+	int level;
+	int hysteresis;
+} ChannelRule;
+
+typedef struct Channel {
+	char name[3];			// two character name used in telemetry, e.g. "T1"
+	unsigned char source;	// one of the channel sources above
+	unsigned char pin;		// ADC input for CH_SRC_ADC
+	int* var;				// variable for CH_SRC_VAR
+	pChannelFunc func;		// function for CH_SRC_DERIVED
+	int mul, div, offset;	// conversion from raw to reported value
+	unsigned char filter;	// low pass filter strength, 0 for none
+	unsigned char rate;		// reported every rate'th report period, 0 to never report
+} Channel;
+
+void channels_init(const Channel* table, unsigned char n);	// Sets the channel table, table must be in flash
+unsigned char channels_count();								// Number of channels
+void channels_get(unsigned char i, Channel* ch);			// Copies the descriptor of channel i from flash
+int  channels_value(unsigned char i);						// Latest value of channel i
+int  channels_find(const char* name);						// Index of the channel with the given name, -1 if none
+void channels_sample(unsigned long now);					// Reads, converts and filters all channels and adds them to the statistics
+void channels_report(unsigned int period);					// Prints the channels due in report period number period
+void channels_describe(unsigned char i);					// Prints the descriptor and value of channel i
+void channels_reset(unsigned char i);						// Restarts the statistics of channel i
+void channels_set_trim(unsigned char i, int trim);			// Sets the run time offset added to channel i
+unsigned char channels_set_rule(unsigned char i, unsigned char type, int level, int hysteresis); // Sets the trigger rule of channel i, returns 0 if the rule is invalid
+unsigned char channels_report_events();						// Prints the first pending event, a line, returns 0 if there was none
+void channels_set_keyframe_interval(unsigned char n);		// Reports between keyframes, 0 turns delta mode off
+
+void _channels_check_rule(unsigned char i, int value, unsigned long now);
+
+const Channel* _channels_table = 0;
+unsigned char _channels_count = 0;
+long _channels_state[CHANNELS_MAX];		// filter state, value * 2^filter
+int  _channels_value[CHANNELS_MAX];
+int  _channels_trim[CHANNELS_MAX];
+// statistics since the last report
+long _channels_sum[CHANNELS_MAX];
+int  _channels_min[CHANNELS_MAX];
+int  _channels_max[CHANNELS_MAX];
+unsigned int _channels_n[CHANNELS_MAX];
+unsigned char _channels_primed = 0;		// set once the filters hold a first sample
+// trigger rules and pending events
+ChannelRule _channels_rule[CHANNELS_MAX];
+int _channels_reported[CHANNELS_MAX];	// value at the last report, for CH_RULE_DELTA
+int _channels_event[CHANNELS_MAX];		// value that triggered the pending event
+unsigned long _channels_event_time[CHANNELS_MAX];	// time of the sample that triggered it
+unsigned int _channels_events = 0;		// pending events, one bit per channel
+// delta mode
+int _channels_sent[CHANNELS_MAX];		// mean last sent, the reference for deltas
+unsigned char _channels_keyframe_interval = 0;
+unsigned char _channels_keyframe_countdown = 0;
+
+
+void channels_init(const Channel* table, unsigned char n) {
+	_channels_table = table;
+	_channels_count = n > CHANNELS_MAX ? CHANNELS_MAX : n;
+	_channels_primed = 0;
+	_channels_events = 0;
+	for(n = 0; n < _channels_count; n++) {
+		channels_reset(n);
+		_channels_trim[n] = 0;
+		_channels_rule[n].type = CH_RULE_NONE;
+	}
+}
+
+unsigned char channels_set_rule(unsigned char i, unsigned char type, int level, int hysteresis) {
+	unsigned char sreg;
+	if(i >= _channels_count || type > CH_RULE_DELTA)
+		return 0;
+	// a delta of 0 or less would fire on every sample and flood the link
+	if(type == CH_RULE_DELTA && level <= 0)
+		return 0;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	_channels_rule[i].type = type;
+	_channels_rule[i].level = level;
+	_channels_rule[i].hysteresis = hysteresis;
+	_channels_rule[i].armed = 1;
+	_channels_reported[i] = _channels_value[i];
+	_channels_events &= ~(1U<<i);
+	SREG = sreg; // restore global interrupt flag state
+	return 1;
+}
+
+void _channels_check_rule(unsigned char i, int value, unsigned long now) {
+	ChannelRule* rule = &_channels_rule[i];
+	unsigned char fire = 0;
+	switch(rule->type) {
+		case CH_RULE_ABOVE:
+			if(rule->armed && value > rule->level) {
+				fire = 1;
+				rule->armed = 0;
+			}
+			else if(!rule->armed && value < (long)rule->level - rule->hysteresis)
+				rule->armed = 1;
+			break;
+		case CH_RULE_BELOW:
+			if(rule->armed && value < rule->level) {
+				fire = 1;
+				rule->armed = 0;
+			}
+			else if(!rule->armed && value > (long)rule->level + rule->hysteresis)
+				rule->armed = 1;
+			break;
+		case CH_RULE_DELTA:
+			if(norm(value - _channels_reported[i]) >= rule->level) {
+				fire = 1;
+				_channels_reported[i] = value;
+			}
+			break;
+	}
+	if(fire && !(_channels_events & 1U<<i)) {
+		// a pending event keeps the sample that first triggered it, the crossing's time is not lost while the line is busy
+		_channels_event[i] = value;
+		_channels_event_time[i] = now;
+		_channels_events |= 1U<<i;
+	}
+}
+
+unsigned char channels_report_events() {
+	unsigned char i, sreg;
+	int value;
+	unsigned long time;
+	Channel ch;
+	for(i = 0; i < _channels_count; i++) {
+		sreg = SREG; //Save global interrupt flag
+		SREG &= ~(1<<7); // disable global interrupt flag
+		if(!(_channels_events & 1U<<i)) {
+			SREG = sreg;
+			continue;
+		}
+		_channels_events &= ~(1U<<i);
+		value = _channels_event[i];
+		time = _channels_event_time[i];
+		SREG = sreg; // restore global interrupt flag state
+		channels_get(i, &ch);
+		printf("!%s:%d,%lu\n", ch.name, value, time);
+		return 1; // one line at a time, so the caller can check it has time to send the next
+	}
+	return 0;
+}
+
+void channels_reset(unsigned char i) {
+	_channels_sum[i] = 0;
+	_channels_n[i] = 0;
+}
+
+void channels_set_trim(unsigned char i, int trim) {
+	unsigned char sreg;
+	if(i >= _channels_count)
+		return;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	_channels_trim[i] = trim;
+	SREG = sreg; // restore global interrupt flag state
+}
+
+unsigned char channels_count() {
+	return _channels_count;
+}
+
+void channels_get(unsigned char i, Channel* ch) {
+	memcpy_P(ch, &_channels_table[i], sizeof(Channel));
+}
+
+int channels_value(unsigned char i) {
+	unsigned char sreg;
+	int value;
+	if(i >= _channels_count)
+		return 0;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	value = _channels_value[i];
+	SREG = sreg; // restore global interrupt flag state
+	return value;
+}
+
+int channels_find(const char* name) {
+	unsigned char i;
+	Channel ch;
+	for(i = 0; i < _channels_count; i++) {
+		channels_get(i, &ch);
+		if(ch.name[0] == name[0] && ch.name[1] == name[1])
+			return i;
+	}
+	return -1;
+}
+
+void channels_sample(unsigned long now) {
+	unsigned char i;
+	Channel ch;
+	int raw;
+	long value;
+	for(i = 0; i < _channels_count; i++) {
+		channels_get(i, &ch);
+		switch(ch.source) {
+			case CH_SRC_ADC:		raw = adc_read(ch.pin); break;
+			case CH_SRC_VAR:		raw = *ch.var; 			break;
+			case CH_SRC_DERIVED:	raw = ch.func(); 		break;
+			default:				raw = 0;
+		}
+		value = (long)raw * ch.mul / (ch.div ? ch.div : 1) + ch.offset + _channels_trim[i];
+		if(ch.filter == 0 || !_channels_primed)
+			_channels_state[i] = value << ch.filter;
+		else
+			_channels_state[i] += value - (_channels_state[i] >> ch.filter);
+		_channels_value[i] = value = _channels_state[i] >> ch.filter;
+
+		if(_channels_n[i] == 0 || value < _channels_min[i])
+			_channels_min[i] = value;
+		if(_channels_n[i] == 0 || value > _channels_max[i])
+			_channels_max[i] = value;
+		if(_channels_n[i] < 0xFFFF) {
+			_channels_sum[i] += value;
+			_channels_n[i]++;
+		}
+		if(_channels_primed)
+			_channels_check_rule(i, value, now);
+	}
+	_channels_primed = 1;
+}
+
+void channels_set_keyframe_interval(unsigned char n) {
+	_channels_keyframe_interval = n;
+	_channels_keyframe_countdown = 0; // start over with a keyframe
+}
+
+void channels_report(unsigned int period) {
+	unsigned char i;
+	unsigned char field = 0, written = 0;
+	unsigned char delta = _channels_keyframe_interval && _channels_keyframe_countdown;
+	unsigned char sreg;
+	Channel ch;
+	int mean, min, max;
+	unsigned int n;
+
+	if(_channels_keyframe_interval) {
+		if(delta) {
+			_channels_keyframe_countdown--;
+			putchar('~');
+		}
+		else {
+			_channels_keyframe_countdown = _channels_keyframe_interval;
+			printf("K1:%d", _channels_keyframe_interval);
+			for(i = 0; i < _channels_count; i++) {
+				channels_get(i, &ch);
+				if(ch.rate)
+					printf(",%s", ch.name);
+			}
+			putchar('\n');
+		}
+	}
+
+	for(i = 0; i < _channels_count; i++) {
+		channels_get(i, &ch);
+		if(!ch.rate)
+			continue;
+		field++;
+		if(period % ch.rate && (delta || !_channels_keyframe_interval))
+			continue; // not due, keyframes carry every channel
+		// take the statistics and start new ones in one go, the next sample may come at any time
+		sreg = SREG; //Save global interrupt flag
+		SREG &= ~(1<<7); // disable global interrupt flag
+		_channels_reported[i] = _channels_value[i];
+		n = _channels_n[i];
+		mean = n ? _channels_sum[i] / n : _channels_value[i];
+		min = _channels_min[i];
+		max = _channels_max[i];
+		channels_reset(i);
+		SREG = sreg; // restore global interrupt flag state
+		if(!delta) {
+			if(n)
+				printf("%s:%d,%d,%d,%u\n", ch.name, mean, min, max, n);
+			else
+				printf("%s:%d,%d,%d,0\n", ch.name, mean, mean, mean);
+		}
+		else if(mean != _channels_sent[i]) {
+			for(; written < field-1; written++)
+				putchar(',');
+			printf("%d", mean - _channels_sent[i]);
+		}
+		_channels_sent[i] = mean;
+	}
+	if(delta)
+		putchar('\n');
+}
+
+void channels_describe(unsigned char i) {
+	Channel ch;
+	if(i >= _channels_count)
+		return;
+	channels_get(i, &ch);
+	printf("C1:%d,%s,%d,%d,%d,%d,%d,%d,%d,%d\n", i, ch.name, ch.source, ch.pin,
+		ch.mul, ch.div, ch.offset, ch.filter, ch.rate, channels_value(i));
+}
+
+#endif
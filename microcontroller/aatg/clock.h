@@ -0,0 +1,66 @@
+ /**
+  * File:   clock.h
+  *
+  * Description:
+  * 	Millisecond system clock driven by timer0 in clear-on-compare mode.
+  * 	Occupies timer0 and its Output Compare Match A interrupt.
+  *
+  * Usage:
+  * 	Call 'clock_init();' and enable global interrupts with 'enable_global_interrupts();'.
+  * 	'clock_millis()' returns the number of milliseconds since 'clock_init();' was called.
+  * 	A function can be run from the interrupt on every tick with 'clock_set_tick_function(func);',
+  * 	keep it short as it runs with interrupts disabled.
+  *
+  */
+
+#ifndef __AATG_CLOCK__
+#define __AATG_CLOCK__
+
+#include <avr/io.h>
+
+#include "interrupts.h"
+#include "timers.h"
+
+#define CLOCK_TICK_HZ 1000 // ticks per second
+#define CLOCK_COMPARE_VALUE (F_CPU/64/CLOCK_TICK_HZ - 1) // 249 at 16MHz with prescaler 64
+
+void clock_init();								// Starts timer0 as a 1 kHz tick source
+unsigned long clock_millis();					// Milliseconds since clock_init(). Safe to call from interrupts
+void clock_set_tick_function(pVoidFunc func);	// Sets function to call from the interrupt on every tick
+
+void _clock_tick();
+
+volatile unsigned long _clock_ms = 0;
+pVoidFunc _clock_tick_function = 0;
+
+
+void clock_init() {
+	_clock_ms = 0;
+	timer0_init(CLEAR_ON_COMPARE, NON_PWM_NORMAL, NON_PWM_NORMAL, CLOCK_PRESCALER_64);
+	timer0_set_output_compare_registerA(CLOCK_COMPARE_VALUE);
+	timer0_set_output_compareA_interrupt_function(_clock_tick);
+	timer0_output_compareA_interrupt_enable();
+}
+
+unsigned long clock_millis() {
+	// turn off interrupts while doing 32 bit read
+	unsigned char sreg;
+	unsigned long ms;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	ms = _clock_ms;
+	SREG = sreg; // restore global interrupt flag state
+	return ms;
+}
+
+void clock_set_tick_function(pVoidFunc func) {
+	_clock_tick_function = func;
+}
+
+void _clock_tick() {
+	_clock_ms++;
+	if(_clock_tick_function)
+		_clock_tick_function();
+}
+
+#endif
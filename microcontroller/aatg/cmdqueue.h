@@ -0,0 +1,107 @@
+ /**
+  * File:   cmdqueue.h
+  *
+  * Description:
+  * 	Time-tagged command queue. Commands are (due time, target, value) triples
+  * 	kept sorted by due time, so executing the queue only ever looks at the head.
+  *
+  * Usage:
+  * 	Set the function that carries out a command with 'cmdqueue_set_function(func);'.
+  * 	Queue commands with 'cmdqueue_push(due, target, value);' where due is in clock_millis() time.
+  * 	Call 'cmdqueue_run(clock_millis());' from a timer interrupt, e.g. the clock.h tick function,
+  * 	to execute commands on the millisecond they are due.
+  *
+  */
+
+#ifndef __AATG_CMDQUEUE__
+#define __AATG_CMDQUEUE__
+
+#include <avr/io.h>
+
+#define CMDQUEUE_SIZE 8
+
+typedef void (*pCmdFunc)(unsigned char target, int value); // function carrying out a command
+
+typedef struct Cmd {
+	unsigned long due;
+	unsigned char target;
+	int value;
+} Cmd;
+
+void cmdqueue_set_function(pCmdFunc func);				// Sets function to call when a command is due
+unsigned char cmdqueue_push(unsigned long due, unsigned char target, int value); // Queues a command, returns 0 if the queue is full
+void cmdqueue_clear();									// Drops all queued commands
+void cmdqueue_run(unsigned long now);					// Executes all commands due at or before now
+unsigned char cmdqueue_length();						// Number of queued commands
+long cmdqueue_next_in(unsigned long now);				// Milliseconds until the next command is due, -1 if the queue is empty
+
+Cmd _cmdqueue[CMDQUEUE_SIZE];
+volatile unsigned char _cmdqueue_length = 0;
+pCmdFunc _cmdqueue_function = 0;
+
+
+void cmdqueue_set_function(pCmdFunc func) {
+	_cmdqueue_function = func;
+}
+
+unsigned char cmdqueue_push(unsigned long due, unsigned char target, int value) {
+	unsigned char sreg;
+	unsigned char i;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+
+	if(_cmdqueue_length >= CMDQUEUE_SIZE) {
+		SREG = sreg;
+		return 0;
+	}
+	// insertion sort, commands due at the same time keep their arrival order
+	i = _cmdqueue_length;
+	while(i > 0 && (long)(_cmdqueue[i-1].due - due) > 0) {
+		_cmdqueue[i] = _cmdqueue[i-1];
+		i--;
+	}
+	_cmdqueue[i].due = due;
+	_cmdqueue[i].target = target;
+	_cmdqueue[i].value = value;
+	_cmdqueue_length++;
+
+	SREG = sreg; // restore global interrupt flag state
+	return 1;
+}
+
+void cmdqueue_clear() {
+	_cmdqueue_length = 0;
+}
+
+void cmdqueue_run(unsigned long now) {
+	unsigned char i;
+	while(_cmdqueue_length && (long)(now - _cmdqueue[0].due) >= 0) {
+		Cmd cmd = _cmdqueue[0];
+		_cmdqueue_length--;
+		for(i = 0; i < _cmdqueue_length; i++)
+			_cmdqueue[i] = _cmdqueue[i+1];
+		if(_cmdqueue_function)
+			_cmdqueue_function(cmd.target, cmd.value);
+	}
+}
+
+unsigned char cmdqueue_length() {
+	return _cmdqueue_length;
+}
+
+long cmdqueue_next_in(unsigned long now) {
+	long next;
+	unsigned char sreg;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	if(_cmdqueue_length == 0)
+		next = -1;
+	else if((long)(_cmdqueue[0].due - now) < 0)
+		next = 0;
+	else
+		next = _cmdqueue[0].due - now;
+	SREG = sreg; // restore global interrupt flag state
+	return next;
+}
+
+#endif
@@ -0,0 +1,171 @@
+ /**
+  * File:   config.h
+  *
+  * Description:
+  * 	Configuration block kept in EEPROM, so settings can be changed over the serial
+  * 	link instead of by reflashing. The block is stored with a version number and a CRC16,
+  * 	and falls back to the defaults in flash when either does not match.
+  * 	Fields are described by a ConfigField table in flash, so they can be read and
+  * 	written by index, and only the bytes of a field that changed are written back.
+  * 	Each field has a range, values outside it are refused before anything is stored, and a
+  * 	stored block with a field out of range, e.g. from an older table, falls back to the defaults.
+  * 	A type or'ed with CFG_ZERO also takes 0 outside its range, for settings where 0 means off.
+  *
+  * Usage:
+  * 	Define a struct holding the settings, its defaults and a field table:
+  * 		const Config configDefaults PROGMEM = {...};
+  * 		const ConfigField configFields[] PROGMEM = {{"name", offsetof(Config, field), CFG_INT, min, max}, ...};
+  * 	then call 'config_init(&config, &configDefaults, sizeof(Config), version, configFields, n);'
+  * 	at boot, before anything uses the settings. It returns 0 if the defaults were loaded.
+  * 	Read the struct directly, change fields with 'config_set(i, value);', which returns 0 if value is out of range.
+  * 	Bump the version whenever the struct layout changes.
+  *
+  * EEPROM layout:
+  * 	version, size, data[size], crc16 (little endian) of version, size and data
+  *
+  */
+
+#ifndef __AATG_CONFIG__
+#define __AATG_CONFIG__
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONFIG_MAX_SIZE 48
+
+// field types
+#define CFG_BYTE	0	// unsigned char
+#define CFG_INT		1	// int
+#define CFG_UINT	2	// unsigned int
+#define CFG_ZERO	0x80	// or'ed with a type: 0 is allowed besides min..max
+
+typedef struct ConfigField {
+	char name[4];			// short name used in replies
+	unsigned char offset;	// offset of the field in the config struct
+	unsigned char type;		// one of the field types above
+	long min, max;			// range of valid values
+} ConfigField;
+
+unsigned char config_init(void* config, const void* defaults, unsigned char size, unsigned char version, const ConfigField* fields, unsigned char n); // Loads the config from EEPROM, or the defaults if it is missing or corrupt
+unsigned char config_count();						// Number of fields
+long config_get(unsigned char i);					// Value of field i
+unsigned char config_set(unsigned char i, long value);	// Sets field i and writes it back if it changed, 0 if value is out of range
+unsigned char config_valid(unsigned char i, long value);	// 1 if value is in the range of field i
+void config_defaults();								// Restores and stores the defaults
+void config_describe(unsigned char i);				// Prints "G1:<index>,<name>,<value>"
+
+unsigned int _config_crc();
+void _config_store_crc();
+
+uint8_t EEMEM _config_store[CONFIG_MAX_SIZE + 4];
+
+unsigned char* _config = 0;
+const void* _config_defaults = 0;
+unsigned char _config_size = 0;
+unsigned char _config_version = 0;
+const ConfigField* _config_fields = 0;
+unsigned char _config_count = 0;
+
+
+unsigned char config_init(void* config, const void* defaults, unsigned char size, unsigned char version, const ConfigField* fields, unsigned char n) {
+	unsigned char i;
+	_config = config;
+	_config_defaults = defaults;
+	_config_size = size > CONFIG_MAX_SIZE ? CONFIG_MAX_SIZE : size;
+	_config_version = version;
+	_config_fields = fields;
+	_config_count = n;
+
+	// one block read and a CRC over RAM, a few hundred microseconds
+	eeprom_read_block(_config, &_config_store[2], _config_size);
+	if(eeprom_read_byte(&_config_store[0]) == _config_version
+			&& eeprom_read_byte(&_config_store[1]) == _config_size
+			&& eeprom_read_word((const uint16_t*)&_config_store[2 + _config_size]) == _config_crc()) {
+		for(i = 0; i < _config_count && config_valid(i, config_get(i)); i++);
+		if(i == _config_count)
+			return 1;
+	}
+	config_defaults();
+	return 0;
+}
+
+void config_defaults() {
+	memcpy_P(_config, _config_defaults, _config_size);
+	eeprom_update_byte(&_config_store[0], _config_version);
+	eeprom_update_byte(&_config_store[1], _config_size);
+	eeprom_update_block(_config, &_config_store[2], _config_size);
+	_config_store_crc();
+}
+
+unsigned char config_count() {
+	return _config_count;
+}
+
+long config_get(unsigned char i) {
+	ConfigField f;
+	if(i >= _config_count)
+		return 0;
+	memcpy_P(&f, &_config_fields[i], sizeof(ConfigField));
+	switch(f.type & ~CFG_ZERO) {
+		case CFG_BYTE:	return *(unsigned char*)(_config + f.offset);
+		case CFG_INT:	return *(int*)(_config + f.offset);
+		default:		return *(unsigned int*)(_config + f.offset);
+	}
+}
+
+unsigned char config_valid(unsigned char i, long value) {
+	ConfigField f;
+	if(i >= _config_count)
+		return 0;
+	memcpy_P(&f, &_config_fields[i], sizeof(ConfigField));
+	if(value == 0 && (f.type & CFG_ZERO))
+		return 1;
+	return value >= f.min && value <= f.max;
+}
+
+unsigned char config_set(unsigned char i, long value) {
+	ConfigField f;
+	unsigned char size;
+	if(!config_valid(i, value))
+		return 0;
+	if(config_get(i) == value)
+		return 1; // nothing to write
+	memcpy_P(&f, &_config_fields[i], sizeof(ConfigField));
+	switch(f.type & ~CFG_ZERO) {
+		case CFG_BYTE:	*(unsigned char*)(_config + f.offset) = value;	size = 1; break;
+		case CFG_INT:	*(int*)(_config + f.offset) = value;			size = 2; break;
+		default:		*(unsigned int*)(_config + f.offset) = value;	size = 2; break;
+	}
+	// eeprom_update only writes bytes that differ, so only this field and the crc wear the EEPROM
+	eeprom_update_block(_config + f.offset, &_config_store[2 + f.offset], size);
+	_config_store_crc();
+	return 1;
+}
+
+void config_describe(unsigned char i) {
+	ConfigField f;
+	if(i >= _config_count)
+		return;
+	memcpy_P(&f, &_config_fields[i], sizeof(ConfigField));
+	printf("G1:%d,%s,%ld\n", i, f.name, config_get(i));
+}
+
+unsigned int _config_crc() {
+	unsigned int crc = 0xFFFF;
+	unsigned char i;
+	crc = _crc16_update(crc, _config_version);
+	crc = _crc16_update(crc, _config_size);
+	for(i = 0; i < _config_size; i++)
+		crc = _crc16_update(crc, _config[i]);
+	return crc;
+}
+
+void _config_store_crc() {
+	eeprom_update_word((uint16_t*)&_config_store[2 + _config_size], _config_crc());
+}
+
+#endif
@@ -0,0 +1,128 @@
+ /**
+  * File:   glyphcache.h
+  *
+  * Description:
+  * 	Cache of the 8 custom characters in the display's CGRAM.
+  * 	Loading a glyph with 'lcd_set_char' takes 9 bytes to the display and moves the cursor, so a
+  * 	glyph asked for again is looked up by a hash of its rows and the slot already holding it is reused.
+  * 	Only when a new glyph does not fit is a slot loaded, the least recently used one.
+  * 	A slot used since the last 'glyphcache_frame();' is still on screen and is never taken,
+  * 	so glyphs drawn in the same frame do not overwrite each other.
+  *
+  * Usage:
+  * 	Call 'glyphcache_frame();' before drawing a frame, then 'glyphcache_get(rows)' for each glyph,
+  * 	rows being 8 rows of 5 pixels like 'lcd_set_char'. It returns the character to write to the display,
+  * 	or GLYPHCACHE_NONE if all 8 slots are used in this frame. Call 'lcd_gotoxy(x,y);' after a miss,
+  * 	as loading a glyph moves the cursor to (0,0).
+  * 	Characters still on screen from earlier frames are protected with 'glyphcache_keep(c);'.
+  * 	'glyphcache_hits()' and 'glyphcache_misses()' count lookups, 'glyphcache_clear();' forgets
+  * 	every slot, e.g. after the display has been reset or CGRAM written directly.
+  *
+  */
+
+#ifndef __AATG_GLYPHCACHE__
+#define __AATG_GLYPHCACHE__
+
+#include <avr/io.h>
+#include <string.h>
+
+#include "lcd.h"
+
+#define GLYPHCACHE_SLOTS 8
+#define GLYPHCACHE_ROWS 8
+#define GLYPHCACHE_NONE 0xFF
+
+unsigned char glyphcache_get(unsigned char* rows);	// Character showing rows, loaded into CGRAM if needed
+void glyphcache_frame();							// Starts a new frame, earlier glyphs may be replaced
+void glyphcache_keep(unsigned char c);				// Counts character c as used in this frame, without a lookup
+void glyphcache_clear();							// Forgets what every slot holds
+unsigned long glyphcache_hits();					// Lookups that found the glyph already loaded
+unsigned long glyphcache_misses();					// Lookups that loaded the glyph
+
+unsigned int _glyphcache_hash(unsigned char* rows);
+
+unsigned char _glyphcache_rows[GLYPHCACHE_SLOTS][GLYPHCACHE_ROWS];
+unsigned int  _glyphcache_key[GLYPHCACHE_SLOTS];	// hash of the rows in each slot
+unsigned int  _glyphcache_used[GLYPHCACHE_SLOTS];	// _glyphcache_clock when last used
+unsigned char _glyphcache_loaded = 0;				// bit per slot holding a glyph
+unsigned int  _glyphcache_clock = 0;				// counts lookups and keeps
+unsigned int  _glyphcache_frame_start = 0;
+unsigned long _glyphcache_hits = 0;
+unsigned long _glyphcache_misses = 0;
+
+
+unsigned char glyphcache_get(unsigned char* rows) {
+	unsigned char glyph[GLYPHCACHE_ROWS];
+	unsigned char i, slot = GLYPHCACHE_NONE;
+	unsigned int key, age, oldest = 0;
+	unsigned int frame_age = _glyphcache_clock - _glyphcache_frame_start;
+
+	for(i = 0; i < GLYPHCACHE_ROWS; i++)
+		glyph[i] = rows[i] & 0x1F; // the display only has 5 columns
+	key = _glyphcache_hash(glyph);
+	_glyphcache_clock++;
+
+	for(i = 0; i < GLYPHCACHE_SLOTS; i++) {
+		if((_glyphcache_loaded & (1<<i)) && _glyphcache_key[i] == key
+				&& !memcmp(_glyphcache_rows[i], glyph, GLYPHCACHE_ROWS)) {
+			_glyphcache_used[i] = _glyphcache_clock;
+			_glyphcache_hits++;
+			return i;
+		}
+	}
+
+	// pick an empty slot, else the least recently used one not used in this frame
+	for(i = 0; i < GLYPHCACHE_SLOTS; i++) {
+		if(!(_glyphcache_loaded & (1<<i))) {
+			slot = i;
+			break;
+		}
+		age = _glyphcache_clock - 1 - _glyphcache_used[i]; // wraps around safely
+		if(age >= frame_age && age >= oldest) {
+			oldest = age;
+			slot = i;
+		}
+	}
+	if(slot == GLYPHCACHE_NONE)
+		return GLYPHCACHE_NONE;
+
+	lcd_set_char(slot, glyph);
+	memcpy(_glyphcache_rows[slot], glyph, GLYPHCACHE_ROWS);
+	_glyphcache_key[slot] = key;
+	_glyphcache_used[slot] = _glyphcache_clock;
+	_glyphcache_loaded |= 1<<slot;
+	_glyphcache_misses++;
+	return slot;
+}
+
+void glyphcache_frame() {
+	_glyphcache_frame_start = _glyphcache_clock;
+}
+
+void glyphcache_keep(unsigned char c) {
+	if(c < GLYPHCACHE_SLOTS)
+		_glyphcache_used[c] = ++_glyphcache_clock;
+}
+
+void glyphcache_clear() {
+	_glyphcache_loaded = 0;
+}
+
+unsigned long glyphcache_hits() {
+	return _glyphcache_hits;
+}
+
+unsigned long glyphcache_misses() {
+	return _glyphcache_misses;
+}
+
+// 5 bits per row, so rotating by 5 spreads 8 rows over the 16 bits
+unsigned int _glyphcache_hash(unsigned char* rows) {
+	unsigned int h = 0;
+	unsigned char i;
+	for(i = 0; i < GLYPHCACHE_ROWS; i++)
+		h = ((h << 5) | (h >> 11)) ^ rows[i];
+	return h;
+}
+
+#endif
@@ -18,6 +18,10 @@
   * 	or printf like function lcd_printf
   *  	clear the screen with 'lcd_clear();'.
   *   	you can also write custom charecters to 8 memory locations in CGRAM (character generator random-access-memory)
+  * 	'lcd_use_busy_flag(true);' makes writes poll the display's busy flag instead of waiting the worst case
+  * 	delays, which needs RW wired to the display. If the flag never clears within LCD_BUSY_TIMEOUT polls
+  * 	the driver falls back to the fixed delays for good.
+  * 	The display sits on PORTC unless LCDPORT and the pins are defined before including this file.
   * 	
   */
 
@@ -30,6 +34,9 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+// wiring, define LCDPORT and every pin before including this file to use another port
+// D4-D7 must be on neighbouring pins, from D4 up
+#ifndef LCDPORT
 #define LCDPORT PORTC
 #define LCDPIN PINC
 #define LCDDDR DDRC
@@ -42,6 +49,8 @@
 #define D5 5
 #define D6 6
 #define D7 7
+#endif
+#define LCD_BUSY_TIMEOUT 500 // busy flag polls, each takes a few microseconds
 
 #define true 1
 #define false 0
@@ -50,6 +59,7 @@ typedef unsigned char byte;
 typedef unsigned char bool;
 
 bool lcd_gotoxy(unsigned char x, unsigned char y);				// Sets cursor position
+unsigned char lcd_address(unsigned char x, unsigned char y);	// DDRAM address of position (x,y)
 void lcd_clear();												// Clears screen and resets cursor position to (0,0)
 void lcd_printf(char* str, ...);								// Printf style formatted string function
 void lcd_put(char c);											// Writes a char to screen
@@ -57,15 +67,18 @@ void lcd_puts(char* str);										// Writes a string to screen
 void lcd_puti(int i);											// Writes integer to screen
 void lcd_set_char(unsigned char addr, unsigned char* rows);		// Stores a custom charecter in Charecter Generator RAM - OBS! Resets cursor position to (0,0)
 void lcd_init();												// Initializes the LCD screen. This should be called before any other LCD calls
+void lcd_use_busy_flag(bool on);								// Polls the busy flag instead of fixed delays, if the display answers
 
 void _lcd_flash();
-void _lcd_check_busy();
+void _lcd_pulse();
+bool _lcd_check_busy();
 void _lcd_write_nibble(unsigned char cmd, bool rs);
 void _lcd_write_byte(unsigned char byte, unsigned char rs);
 void _lcd_set_cgram_address(unsigned char addr);
 void _lcd_set_ddram_address(unsigned char addr);
 
 bool lcd_initialised = false;
+bool lcd_busy_flag = false;	// polling the busy flag, cleared if the display stops answering
 int cursor_pos_x = 0;
 int cursor_pos_y = 0;
 
@@ -75,7 +88,14 @@ bool lcd_gotoxy(unsigned char x, unsigned char y) {
 	if(x >= 20 || y >= 4)
 		return false;
 	
-	int addr = x;
+	cursor_pos_x = x;
+	cursor_pos_y = y;
+	_lcd_set_ddram_address(lcd_address(x, y));
+	return true;
+}
+
+unsigned char lcd_address(unsigned char x, unsigned char y) {
+	unsigned char addr = x;
 	switch(y) {
 		case 1:
 			addr += 0x40;
@@ -87,15 +107,13 @@ bool lcd_gotoxy(unsigned char x, unsigned char y) {
 			addr += 0x54;
 			break;
 	}
-	cursor_pos_x = x;
-	cursor_pos_y = y;
-	_lcd_set_ddram_address(addr);
-	return true;
+	return addr;
 }
 
 void lcd_clear() {
 	_lcd_write_byte(1,0);
-	_delay_ms(2);
+	if(!lcd_busy_flag)
+		_delay_ms(2);
 	lcd_gotoxy(0,0);
 }
 
@@ -168,7 +186,7 @@ void lcd_init() {
 	if(lcd_initialised)
 		return;
 	lcd_initialised = true;
-	LCDDDR = 0xFF;
+	LCDDDR |= 1<<RS | 1<<RW | 1<<EN | 1<<BL | 0x0F<<D4; // only the display's pins, the port may be shared
 
 	_delay_ms(1000);	//Wait for boot
 	//Function set
@@ -183,7 +201,7 @@ void lcd_init() {
 	_lcd_write_byte(0b00000110,0);	// set increment mode and entire shifts off
 	_delay_ms(20);
 
-	LCDPORT = 1<<BL; // turn on backlight
+	LCDPORT |= 1<<BL; // turn on backlight
 }
 
 void _lcd_flash() {
@@ -194,21 +212,44 @@ void _lcd_flash() {
 	_delay_us(100);
 }
 
-void _lcd_check_busy() {
-	LCDDDR = 1<<EN | 1<<RW | 1<<RS;
-	LCDPORT |=  (1<<RW);
+void lcd_use_busy_flag(bool on) {
+	lcd_busy_flag = on;
+}
+
+// enable pulse for busy flag mode, the display needs 450 ns high and 1 us per cycle
+void _lcd_pulse() {
+	LCDPORT |=  (1<<EN);
+	_delay_us(1);
+	LCDPORT &= ~(1<<EN);
+	_delay_us(1);
+}
+
+// waits until the display is ready for the next byte, returns false if it did not answer in time
+bool _lcd_check_busy() {
+	unsigned int polls;
+	bool busy = true;
+	LCDDDR  &= ~(0x0F<<D4);		// data lines as inputs
+	LCDPORT &= ~(0x0F<<D4);
+	LCDPORT |=  (1<<BF);		// pulled up, with RW not wired nothing drives D7 and it reads busy until the timeout
 	LCDPORT &= ~(1<<RS);
+	LCDPORT |=  (1<<RW);		// read busy flag and address
 
-	while (LCDPIN & (1<<BF)) {
-		_lcd_flash();
+	for(polls = 0; busy && polls < LCD_BUSY_TIMEOUT; polls++) {
+		LCDPORT |=  (1<<EN);
+		_delay_us(1);
+		busy = LCDPIN & (1<<BF);	// high nibble, busy flag on D7
+		LCDPORT &= ~(1<<EN);
+		_delay_us(1);
+		_lcd_pulse();				// low nibble, part of the address
 	}
 
-	LCDDDR = 0xFF;
 	LCDPORT &= ~(1<<RW);
+	LCDPORT &= ~(1<<BF);
+	LCDDDR  |=  (0x0F<<D4);
+	return !busy;
 }
 
 void _lcd_write_nibble(unsigned char nibble, bool rs) {
-	//_lcd_check_busy();
 	LCDPORT &= ~(0x0F<<D4);
 	LCDPORT &= ~(1<<RW); 		// Write mode
 	if(rs)
@@ -217,10 +258,17 @@ void _lcd_write_nibble(unsigned char nibble, bool rs) {
 		LCDPORT &= ~(1<<RS);	// Command mode
 	
 	LCDPORT |=  (nibble<<D4);
-	_lcd_flash();
+	if(lcd_busy_flag)
+		_lcd_pulse();
+	else
+		_lcd_flash();
 }
 
 void _lcd_write_byte(unsigned char byte, unsigned char rs) {
+	if(lcd_busy_flag && !_lcd_check_busy()) {
+		lcd_busy_flag = false; // no answer, RW is probably not wired, so use the fixed delays from now on
+		_delay_ms(2);
+	}
 	_lcd_write_nibble((byte >> 4) & 0x0F, rs); 	// Send latter four bits
 	_lcd_write_nibble(byte & 0x0F, rs);  		// Send former fout bits
 }
@@ -0,0 +1,180 @@
+ /**
+  * File:   lcdbuf.h
+  *
+  * Description:
+  * 	Shadow framebuffer for the 20x4 character display in lcd.h.
+  * 	The application writes to a buffer in RAM and 'lcdbuf_flush();' sends only the cells that
+  * 	differ from what the display already shows. Every byte sent to the display costs two
+  * 	enable pulses and their delays, so redrawing a mostly unchanged screen becomes nearly free.
+  * 	Consecutive dirty cells are sent as one run, so only the first needs a DDRAM address command.
+  * 	Rows are visited in DDRAM order (0, 2, 1, 3), as the display continues row 0 on row 2
+  * 	and row 1 on row 3, so a full redraw needs two address commands.
+  *
+  * Usage:
+  * 	Call 'lcdbuf_init();' instead of 'lcd_init();'. Draw with 'lcdbuf_gotoxy(x,y);', 'lcdbuf_put(c);',
+  * 	'lcdbuf_puts(str);', 'lcdbuf_puti(i);', 'lcdbuf_printf(format, ...);' and 'lcdbuf_clear();', which work
+  * 	like their lcd.h counterparts but only change the buffer. Call 'lcdbuf_flush();' to update the display,
+  * 	it returns the number of bytes sent. After writing to the display directly, call
+  * 	'lcdbuf_invalidate();' so the next flush sends every cell.
+  * 	To send through lcdqueue.h instead of waiting for the display, start the display with
+  * 	'lcdqueue_init();' and call 'lcdbuf_attach(lcdqueue_write);' instead of 'lcdbuf_init();'.
+  * 	A flush then stops when the queue is full, and the next flush carries on with the cells left.
+  *
+  */
+
+#ifndef __AATG_LCDBUF__
+#define __AATG_LCDBUF__
+
+#include <avr/io.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lcd.h"
+
+#define LCDBUF_COLS 20
+#define LCDBUF_ROWS 4
+#define LCDBUF_CELLS (LCDBUF_COLS*LCDBUF_ROWS)
+#define LCDBUF_NO_ADDR 0xFF	// display address counter unknown
+
+typedef bool (*pLcdbufWrite)(unsigned char byte, unsigned char rs); // sends a command (rs 0) or character (rs 1), false if it could not
+
+void lcdbuf_init();										// Initializes the display and clears both buffer and display
+void lcdbuf_attach(pLcdbufWrite write);					// Clears the buffer and sends through write, the display must be cleared
+void lcdbuf_clear();									// Fills the buffer with spaces and moves the cursor to (0,0)
+bool lcdbuf_gotoxy(unsigned char x, unsigned char y);	// Sets the buffer cursor
+void lcdbuf_put(char c);								// Writes a char to the buffer
+void lcdbuf_puts(char* str);							// Writes a string to the buffer, '\n' starts the next line
+void lcdbuf_puti(int i);								// Writes an integer to the buffer
+void lcdbuf_printf(char* str, ...);						// Printf style formatted string function
+void lcdbuf_set(unsigned char x, unsigned char y, char c);	// Sets the cell at (x,y) without moving the cursor
+char lcdbuf_get(unsigned char x, unsigned char y);		// Cell at (x,y) in the buffer
+unsigned int lcdbuf_flush();							// Sends the cells that changed, returns the bytes sent
+void lcdbuf_invalidate();								// Makes the next flush send every cell
+
+bool _lcdbuf_write_direct(unsigned char byte, unsigned char rs);
+
+char _lcdbuf_want[LCDBUF_ROWS][LCDBUF_COLS];	// what the application drew
+char _lcdbuf_shown[LCDBUF_ROWS][LCDBUF_COLS];	// what the display shows
+unsigned char _lcdbuf_x = 0;
+unsigned char _lcdbuf_y = 0;
+unsigned char _lcdbuf_stale = LCDBUF_CELLS;	// cells from here on, in flush order, are sent even if unchanged
+pLcdbufWrite _lcdbuf_write = _lcdbuf_write_direct;
+const unsigned char _lcdbuf_row_order[LCDBUF_ROWS] = {0, 2, 1, 3};
+
+
+void lcdbuf_init() {
+	lcd_init();
+	lcd_clear();
+	lcdbuf_attach(_lcdbuf_write_direct);
+}
+
+void lcdbuf_attach(pLcdbufWrite write) {
+	unsigned char x, y;
+	_lcdbuf_write = write;
+	for(y = 0; y < LCDBUF_ROWS; y++)
+		for(x = 0; x < LCDBUF_COLS; x++)
+			_lcdbuf_want[y][x] = _lcdbuf_shown[y][x] = ' ';
+	_lcdbuf_x = _lcdbuf_y = 0;
+	_lcdbuf_stale = LCDBUF_CELLS;
+}
+
+void lcdbuf_clear() {
+	unsigned char x, y;
+	for(y = 0; y < LCDBUF_ROWS; y++)
+		for(x = 0; x < LCDBUF_COLS; x++)
+			_lcdbuf_want[y][x] = ' ';
+	_lcdbuf_x = _lcdbuf_y = 0;
+}
+
+bool lcdbuf_gotoxy(unsigned char x, unsigned char y) {
+	if(x >= LCDBUF_COLS || y >= LCDBUF_ROWS)
+		return false;
+	_lcdbuf_x = x;
+	_lcdbuf_y = y;
+	return true;
+}
+
+void lcdbuf_put(char c) {
+	if(c == '\n') {
+		_lcdbuf_x = 0;
+		_lcdbuf_y++;
+		return;
+	}
+	if(_lcdbuf_x >= LCDBUF_COLS) {
+		_lcdbuf_x = 0;
+		_lcdbuf_y++;
+	}
+	if(_lcdbuf_y >= LCDBUF_ROWS)
+		return;
+	_lcdbuf_want[_lcdbuf_y][_lcdbuf_x++] = c;
+}
+
+void lcdbuf_puts(char* str) {
+	while(*str)
+		lcdbuf_put(*str++);
+}
+
+void lcdbuf_puti(int i) {
+	char buffer[7];
+	itoa(i, buffer, 10);
+	lcdbuf_puts(buffer);
+}
+
+void lcdbuf_printf(char* str, ...) {
+	va_list args;
+	char buffer[LCDBUF_CELLS + 1];
+	va_start(args, str);
+	vsnprintf(buffer, sizeof(buffer), str, args);
+	va_end(args);
+	lcdbuf_puts(buffer);
+}
+
+void lcdbuf_set(unsigned char x, unsigned char y, char c) {
+	if(x < LCDBUF_COLS && y < LCDBUF_ROWS)
+		_lcdbuf_want[y][x] = c;
+}
+
+char lcdbuf_get(unsigned char x, unsigned char y) {
+	return x < LCDBUF_COLS && y < LCDBUF_ROWS ? _lcdbuf_want[y][x] : ' ';
+}
+
+unsigned int lcdbuf_flush() {
+	unsigned char i, x, y, addr, n;
+	unsigned char next = LCDBUF_NO_ADDR; // where the display's address counter points
+	unsigned int sent = 0;
+	for(i = 0; i < LCDBUF_ROWS; i++) {
+		y = _lcdbuf_row_order[i];
+		for(x = 0; x < LCDBUF_COLS; x++) {
+			n = i*LCDBUF_COLS + x;
+			if(n < _lcdbuf_stale && _lcdbuf_want[y][x] == _lcdbuf_shown[y][x])
+				continue;
+			addr = lcd_address(x, y);
+			if(addr != next) {
+				if(!_lcdbuf_write(0b10000000 | addr, 0)) // set DDRAM address
+					return sent; // no room, the next flush carries on from here
+				sent++;
+				next = addr;
+			}
+			if(!_lcdbuf_write(_lcdbuf_want[y][x], 1))
+				return sent;
+			sent++;
+			_lcdbuf_shown[y][x] = _lcdbuf_want[y][x];
+			if(n >= _lcdbuf_stale)
+				_lcdbuf_stale = n + 1;
+			next = addr + 1; // the display moves on by itself
+		}
+	}
+	return sent;
+}
+
+void lcdbuf_invalidate() {
+	_lcdbuf_stale = 0;
+}
+
+bool _lcdbuf_write_direct(unsigned char byte, unsigned char rs) {
+	_lcd_write_byte(byte, rs);
+	return true;
+}
+
+#endif
@@ -0,0 +1,162 @@
+ /**
+  * File:   lcdqueue.h
+  *
+  * Description:
+  * 	Non-blocking output to the character display in lcd.h.
+  * 	Commands and characters are put in a ring buffer and 'lcdqueue_tick();', called from a
+  * 	timer interrupt, sends one byte per tick. At the clock.h 1 ms tick the display has always
+  * 	finished the previous byte, so a byte needs no delays beyond its two enable pulses, a few
+  * 	microseconds. Clearing the display, which takes the display 1.5 ms, and the boot sequence
+  * 	queue waits of whole ticks instead of busy waiting, so nothing here ever holds up the caller.
+  * 	A full 20x4 redraw takes about 90 ms to reach the display but only microseconds of CPU time per tick.
+  *
+  * Usage:
+  * 	Call 'lcdqueue_init();' instead of 'lcd_init();' and call 'lcdqueue_tick();' from a timer interrupt,
+  * 	e.g. the clock.h tick function. Queue output with 'lcdqueue_gotoxy(x,y);', 'lcdqueue_put(c);',
+  * 	'lcdqueue_puts(str);' and 'lcdqueue_clear();', they return false if the queue is full.
+  * 	'lcdqueue_busy()' is true until the queue has been sent, 'lcdqueue_wait();' waits for that.
+  * 	With lcdbuf.h, 'lcdbuf_attach(lcdqueue_write);' makes 'lcdbuf_flush();' queue the cells that changed.
+  * 	Do not mix with the blocking functions in lcd.h while the queue is busy.
+  *
+  */
+
+#ifndef __AATG_LCDQUEUE__
+#define __AATG_LCDQUEUE__
+
+#include <avr/io.h>
+
+#include "lcd.h"
+
+#ifndef LCDQUEUE_SIZE
+#define LCDQUEUE_SIZE 64	// entries, a power of two
+#endif
+
+// entry kinds, the low byte holds the byte or number of ticks
+#define LCDQUEUE_COMMAND	0x000
+#define LCDQUEUE_DATA		0x100
+#define LCDQUEUE_NIBBLE		0x200	// high nibble only, for switching to 4-bit mode
+#define LCDQUEUE_WAIT		0x400	// send nothing for a number of ticks
+
+void lcdqueue_init();										// Queues the display's boot sequence, takes about 1 s to run
+bool lcdqueue_push(unsigned int entry);						// Queues one entry, returns false if the queue is full
+bool lcdqueue_write(unsigned char byte, unsigned char rs);	// Queues a command (rs 0) or character (rs 1)
+bool lcdqueue_gotoxy(unsigned char x, unsigned char y);		// Queues a cursor move
+bool lcdqueue_put(char c);									// Queues a character
+bool lcdqueue_puts(char* str);								// Queues a string, false if it did not fit entirely
+bool lcdqueue_clear();										// Queues clearing the display
+unsigned char lcdqueue_free();								// Entries that can be queued right now
+bool lcdqueue_busy();										// True while anything is left to send
+void lcdqueue_wait();										// Waits until everything is sent, needs interrupts enabled
+void lcdqueue_tick();										// Sends the next entry, call from a timer interrupt
+
+void _lcdqueue_send(unsigned char nibble, unsigned char rs);
+
+volatile unsigned int _lcdqueue[LCDQUEUE_SIZE];
+volatile unsigned char _lcdqueue_head = 0;	// next free entry, moved by the caller
+volatile unsigned char _lcdqueue_tail = 0;	// next entry to send, moved by the interrupt
+volatile unsigned char _lcdqueue_wait = 0;	// ticks left of a wait
+
+
+void lcdqueue_init() {
+	LCDDDR |= 1<<RS | 1<<RW | 1<<EN | 1<<BL | 0x0F<<D4;
+	LCDPORT &= ~(1<<RS | 1<<RW | 1<<EN | 0x0F<<D4);
+	LCDPORT |= 1<<BL; // backlight on
+	lcd_initialised = true;
+	_lcdqueue_head = _lcdqueue_tail = _lcdqueue_wait = 0;
+	// the same sequence as lcd_init()
+	lcdqueue_push(LCDQUEUE_WAIT | 250);
+	lcdqueue_push(LCDQUEUE_WAIT | 250);
+	lcdqueue_push(LCDQUEUE_WAIT | 250);
+	lcdqueue_push(LCDQUEUE_WAIT | 250);
+	lcdqueue_push(LCDQUEUE_NIBBLE | 0b0010);		// Set 4-bit mode
+	lcdqueue_push(LCDQUEUE_WAIT | 10);
+	lcdqueue_push(LCDQUEUE_COMMAND | 0b00101000);	// Set 2-line mode and display off
+	lcdqueue_push(LCDQUEUE_COMMAND | 0b00001100);	// display on, cursor off, blink off
+	lcdqueue_clear();
+	lcdqueue_push(LCDQUEUE_COMMAND | 0b00000110);	// set increment mode and entire shifts off
+}
+
+bool lcdqueue_push(unsigned int entry) {
+	unsigned char next = (_lcdqueue_head + 1) & (LCDQUEUE_SIZE - 1);
+	if(next == _lcdqueue_tail)
+		return false;
+	_lcdqueue[_lcdqueue_head] = entry;
+	_lcdqueue_head = next; // single byte store, so the interrupt never sees half an entry
+	return true;
+}
+
+bool lcdqueue_write(unsigned char byte, unsigned char rs) {
+	return lcdqueue_push((rs ? LCDQUEUE_DATA : LCDQUEUE_COMMAND) | byte);
+}
+
+bool lcdqueue_gotoxy(unsigned char x, unsigned char y) {
+	if(x >= 20 || y >= 4)
+		return false;
+	return lcdqueue_push(LCDQUEUE_COMMAND | 0b10000000 | lcd_address(x, y));
+}
+
+bool lcdqueue_put(char c) {
+	return lcdqueue_push(LCDQUEUE_DATA | (unsigned char)c);
+}
+
+bool lcdqueue_puts(char* str) {
+	while(*str)
+		if(!lcdqueue_put(*str++))
+			return false;
+	return true;
+}
+
+bool lcdqueue_clear() {
+	if(lcdqueue_free() < 2)
+		return false;
+	lcdqueue_push(LCDQUEUE_COMMAND | 0b00000001);
+	lcdqueue_push(LCDQUEUE_WAIT | 2); // the display takes 1.52 ms to clear
+	return true;
+}
+
+unsigned char lcdqueue_free() {
+	return (_lcdqueue_tail - _lcdqueue_head - 1) & (LCDQUEUE_SIZE - 1);
+}
+
+bool lcdqueue_busy() {
+	return _lcdqueue_head != _lcdqueue_tail || _lcdqueue_wait;
+}
+
+void lcdqueue_wait() {
+	while(lcdqueue_busy());
+}
+
+void lcdqueue_tick() {
+	unsigned int entry;
+	if(_lcdqueue_wait) {
+		_lcdqueue_wait--;
+		return;
+	}
+	if(_lcdqueue_head == _lcdqueue_tail)
+		return;
+	entry = _lcdqueue[_lcdqueue_tail];
+	_lcdqueue_tail = (_lcdqueue_tail + 1) & (LCDQUEUE_SIZE - 1);
+
+	if(entry & LCDQUEUE_WAIT) {
+		_lcdqueue_wait = entry & 0xFF;
+		if(_lcdqueue_wait)
+			_lcdqueue_wait--; // this tick counts as the first
+	} else if(entry & LCDQUEUE_NIBBLE) {
+		_lcdqueue_send(entry & 0x0F, 0);
+	} else {
+		_lcdqueue_send((entry >> 4) & 0x0F, (entry & LCDQUEUE_DATA) != 0);
+		_lcdqueue_send(entry & 0x0F, (entry & LCDQUEUE_DATA) != 0);
+	}
+}
+
+void _lcdqueue_send(unsigned char nibble, unsigned char rs) {
+	LCDPORT &= ~(0x0F<<D4 | 1<<RW);
+	if(rs)
+		LCDPORT |=  (1<<RS);
+	else
+		LCDPORT &= ~(1<<RS);
+	LCDPORT |= nibble<<D4;
+	_lcd_pulse();
+}
+
+#endif
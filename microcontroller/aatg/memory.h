@@ -0,0 +1,87 @@
+ /**
+  * File:   memory.h
+  *
+  * Description:
+  * 	RAM usage measurements. Before main() runs, everything between the end of the static
+  * 	variables and the top of the stack is painted with MEMORY_PAINT. The stack grows down
+  * 	into that space and the heap up into it, so the painted bytes left over show the
+  * 	deepest the stack has been since boot.
+  *
+  * Usage:
+  * 	Include this file in the program, the painting happens on its own.
+  * 	'memory_free()' is the space between heap and stack right now,
+  * 	'memory_stack_max()' the deepest the stack has been and
+  * 	'memory_unused()' the bytes never touched by stack or heap, the real headroom.
+  * 	'memory_describe();' prints all of them on one line.
+  *
+  */
+
+#ifndef __AATG_MEMORY__
+#define __AATG_MEMORY__
+
+#include <avr/io.h>
+#include <stdio.h>
+
+#define MEMORY_PAINT 0xC5
+
+unsigned int memory_free();			// Bytes between the heap and the stack pointer
+unsigned int memory_stack_max();	// Most bytes the stack has used since boot
+unsigned int memory_unused();		// Bytes never used by stack or heap since boot
+unsigned int memory_heap();			// Bytes taken by malloc
+unsigned int memory_static();		// Bytes taken by static variables, .data and .bss
+void memory_describe();				// Prints "M1:<free>,<stack max>,<unused>,<heap>,<static>"
+
+void _memory_paint() __attribute__((naked, used, section(".init1")));
+unsigned char* _memory_heap_end();
+
+// symbols from the linker script and avr-libc's malloc, __brkval only exists when malloc is linked in
+extern unsigned char __data_start;
+extern unsigned char __bss_end;
+extern unsigned char __heap_start;
+extern char* __brkval __attribute__((weak));
+
+
+// runs from .init1, before the stack pointer is set up, so no calls and no locals on the stack
+void _memory_paint() {
+	unsigned char* p = &__heap_start;
+	while(p <= (unsigned char*)RAMEND)
+		*p++ = MEMORY_PAINT;
+}
+
+unsigned char* _memory_heap_end() {
+	if(!&__brkval || !__brkval)
+		return &__heap_start; // malloc not linked in or not called yet, the heap is unused
+	return (unsigned char*)__brkval;
+}
+
+unsigned int memory_free() {
+	return SP - (unsigned int)_memory_heap_end();
+}
+
+unsigned int memory_unused() {
+	unsigned char* p = _memory_heap_end();
+	unsigned int n = 0;
+	while(p <= (unsigned char*)RAMEND && *p == MEMORY_PAINT) {
+		p++;
+		n++;
+	}
+	return n;
+}
+
+unsigned int memory_stack_max() {
+	return RAMEND + 1 - (unsigned int)_memory_heap_end() - memory_unused();
+}
+
+unsigned int memory_heap() {
+	return (unsigned int)_memory_heap_end() - (unsigned int)&__heap_start;
+}
+
+unsigned int memory_static() {
+	return (unsigned int)&__bss_end - (unsigned int)&__data_start;
+}
+
+void memory_describe() {
+	printf("M1:%u,%u,%u,%u,%u\n", memory_free(), memory_stack_max(), memory_unused(), memory_heap(), memory_static());
+}
+
+#endif
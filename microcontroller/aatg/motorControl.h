@@ -3,7 +3,7 @@
 
 #include <avr/io.h>
 #include <util/delay.h>
-#include <stdlib.h>
+#include <avr/pgmspace.h>
 
 #include "essentials.h"
 #include "lcd.h"
@@ -19,52 +19,81 @@
 #define MOTORPORT PORTA
 #define nCoils 4
 
+// motors are taken from fixed pools instead of the heap, so RAM use is known at build time
+#ifndef STEPMOTOR_POOL
+#define STEPMOTOR_POOL 4
+#endif
+#ifndef DCMOTOR_POOL
+#define DCMOTOR_POOL 1
+#endif
+
 typedef struct Stepmotor {
-	int angle10;
-	int stepSize10;
+	int angle20;		// angle in 1/20 degrees, 0 to 7199
+	int stepSize20;		// angle of one step in the stepping scheme, in 1/20 degrees
 	volatile uint8_t* port;
-	int currPhase;
-	unsigned char tmp; // for use when half-stepping
-	unsigned char nPhases;
-	unsigned char* phaseIndex;
-	unsigned char steppingScheme;
+	unsigned char mask;	// port bits of all phases, set once at init
+	unsigned char table[8];	// port value of the phases at each position of the stepping scheme
+	unsigned char position : 3;	// current position in table
+	unsigned char steppingScheme : 2;
 } Stepmotor;
 
-void _modulatePhase(Stepmotor* motor);
-Stepmotor* stepmotor_init(int stepSize10, unsigned char steppingScheme, volatile uint8_t* port, unsigned char nPhases, unsigned char* phaseIndex);
+Stepmotor* stepmotor_init(int stepSize10, unsigned char steppingScheme, volatile uint8_t* port, unsigned char nPhases, unsigned char* phaseIndex);	// 0 when all STEPMOTOR_POOL motors are taken or nPhases is not nCoils
+int stepMotor_get_angle(Stepmotor* motor);
 void stepmotor_set_angle(Stepmotor* motor, int angle);
 void stepmotor_step(Stepmotor* motor, long int steps);
 void stepmotor_step_wave_drive(Stepmotor* motor, char direction);
 void stepmotor_step_full_step(Stepmotor* motor, char direction);
 void stepmotor_step_half_step(Stepmotor* motor, char direction);
+void stepmotor_advance(Stepmotor* motor, char direction);		// One step in the motor's stepping scheme, without waiting
 //--------------------------------------------------------------//
 typedef struct Dcmotor {
 	volatile uint8_t* PWM_port;
+	volatile uint8_t* PWM_ocr;		// compare register of the timer channel on the PWM pin
 	volatile uint8_t* direction_port;
-	unsigned char PWM_pin;
-	unsigned char direction_pin;
-
+	unsigned char PWM_pin : 3;
+	unsigned char direction_pin : 3;
 } Dcmotor;
 
-void dcmotor_set_speed(int speed);
+Dcmotor* dcmotor_new(volatile uint8_t* PWM_port, unsigned char PWM_pin, volatile uint8_t* PWM_ocr, volatile uint8_t* direction_port, unsigned char direction_pin);	// 0 when all DCMOTOR_POOL motors are taken
+void dcmotor_init(Dcmotor* motor);								// Makes the motor's pins outputs and stops it
+void dcmotor_set_speed(Dcmotor* motor, int speed);				// -255 to 255, negative is counterclockwise
 
-void _modulatePhase(Stepmotor* motor) {
-	if(motor->currPhase < 0)
-		motor->currPhase += motor->nPhases;
-	else if(motor->currPhase >= motor->nPhases)
-		motor->currPhase %= motor->nPhases;
-}
+Stepmotor _stepmotor_pool[STEPMOTOR_POOL];
+unsigned char _stepmotor_used = 0;
+Dcmotor _dcmotor_pool[DCMOTOR_POOL];
+unsigned char _dcmotor_used = 0;
+
+// coils on at each position of each stepping scheme, bit i being phaseIndex[i],
+// wave and full step repeat after 4 positions and are stored twice so every scheme is 8 long
+const unsigned char _stepmotor_patterns[3][8] PROGMEM = {
+	{0b0001, 0b0010, 0b0100, 0b1000, 0b0001, 0b0010, 0b0100, 0b1000},	// WAVE_DRIVE
+	{0b0011, 0b0110, 0b1100, 0b1001, 0b0011, 0b0110, 0b1100, 0b1001},	// FULL_STEP
+	{0b0001, 0b0011, 0b0010, 0b0110, 0b0100, 0b1100, 0b1000, 0b1001}	// HALF_STEP
+};
 
 Stepmotor* stepmotor_init(int stepSize10, unsigned char steppingScheme, volatile uint8_t* port, unsigned char nPhases, unsigned char* phaseIndex) {
-	Stepmotor* motor = (Stepmotor*)malloc(sizeof(Stepmotor));
-	motor->tmp = 0;
-	motor->angle10 = 0;
-	motor->currPhase = 0;
+	Stepmotor* motor;
+	unsigned char i, j, coils;
+	if(_stepmotor_used >= STEPMOTOR_POOL || nPhases != nCoils)
+		return 0;
+	motor = &_stepmotor_pool[_stepmotor_used++];
+	motor->angle20 = 0;
+	// a half step is half the angle of a full step
+	motor->stepSize20 = steppingScheme == HALF_STEP ? stepSize10 : 2*stepSize10;
 	motor->port = port;
-	motor->nPhases = nPhases;
-	motor->stepSize10 = stepSize10;
-	motor->phaseIndex = phaseIndex;
+	motor->position = 0;
 	motor->steppingScheme = steppingScheme;
+	// the scheme's table turned into port bits for this motor's pins
+	motor->mask = 0;
+	for(j = 0; j < nCoils; j++)
+		motor->mask |= 1<<phaseIndex[j];
+	for(i = 0; i < 8; i++) {
+		coils = pgm_read_byte(&_stepmotor_patterns[steppingScheme][i]);
+		motor->table[i] = 0;
+		for(j = 0; j < nCoils; j++)
+			if(coils & (1<<j))
+				motor->table[i] |= 1<<phaseIndex[j];
+	}
 	return motor;
 }
 
@@ -72,33 +101,30 @@ Stepmotor* stepmotor_init(int stepSize10, unsigned char steppingScheme, volatile
 /**
  * Get the current angle of the stepmotor
  * @param {Stepmotor*} motor: pointer to Stepmotor structure
- * @return {int} angle
+ * @return {int} angle, 0 to 359
  */
 int stepMotor_get_angle(Stepmotor* motor) {
-	return motor->angle10 / 10;
+	return motor->angle20 / 20;
 }
 
 /**
- * Set a stepmotor to a certain angle
+ * Set a stepmotor to a certain angle, turning the shortest way
  * @param {Stepmotor*} motor: motor pointer structure
  * @param {int} angle: angle to set the motor to
  */
 void stepmotor_set_angle(Stepmotor* motor, int angle) {
-	
-	while(angle <= -360)
+	angle %= 360;
+	if(angle < 0)
 		angle += 360;
-	if(angle >= 360)
-		angle %= 360;
-	// angle is now between -360 and +360
-	angle = angle * 10; // make angle to 10*angle format
-	if ((angle - motor->angle10 + 3600) % 3600 <= 1800) {
+	angle = angle * 20; // make angle to 20*angle format
+	if((angle - motor->angle20 + 7200) % 7200 <= 3600) {
 		// clockwise
-		while(norm(angle - motor->angle10) > motor->stepSize10)
+		while((angle - motor->angle20 + 7200) % 7200 > motor->stepSize20)
 			stepmotor_step(motor, CLOCKWISE);
 	}
 	else {
 		// anti-clockwise
-		while(norm(angle - motor->angle10) > motor->stepSize10)
+		while((motor->angle20 - angle + 7200) % 7200 > motor->stepSize20)
 			stepmotor_step(motor, COUNTERCLOCKWISE);
 	}
 }
@@ -110,10 +136,10 @@ void stepmotor_set_angle(Stepmotor* motor, int angle) {
  */
 void stepmotor_step(Stepmotor* motor, long int steps) {
 	char direction = CLOCKWISE;
-	if(steps < 0)
+	if(steps < 0) {
 		direction = COUNTERCLOCKWISE;
-	
-	steps = norm(steps);
+		steps = -steps;
+	}
 
 	switch(motor->steppingScheme) {
 		case WAVE_DRIVE:
@@ -131,115 +157,94 @@ void stepmotor_step(Stepmotor* motor, long int steps) {
 	}
 }
 
-void stepmotor_step_wave_drive(Stepmotor* motor, char direction) {
-	// turn off 0, 
-	// turn on  1
-
-	// turn off current phase
-	*motor->port &= ~(1<<motor->phaseIndex[motor->currPhase]);
-	
-	// change current phase
-	motor->currPhase += direction;
-	_modulatePhase(motor);
-	
-	// turn on next phase
-	*motor->port |=  (1<<motor->phaseIndex[motor->currPhase]);
-
-	// set angle
-	motor->angle10 += motor->stepSize10*(direction);
-	if(motor->angle10 < -1800)
-		motor->angle10 += 3600;
-	else if(motor->angle10 > 1800)
-		motor->angle10 -= 3600;
+// the stepping scheme is in the motor's table, these only differ in how long they wait
 
+void stepmotor_step_wave_drive(Stepmotor* motor, char direction) {
+	stepmotor_advance(motor, direction);
 	delay_ms(DEFAULT_DELAY);
 }
 
 void stepmotor_step_full_step(Stepmotor* motor, char direction) {
-	// turn off -1
-	// turn on   1
-
-	// change current phase
-	motor->currPhase -= direction;
-	_modulatePhase(motor);
-	
-	// turn off current phase
-	*motor->port &= ~(1<<motor->phaseIndex[motor->currPhase]);
-
-	// change current phase
-	motor->currPhase += 2*direction;
-	_modulatePhase(motor);
-
-	// turn on next phase
-	*motor->port |=  (1<<motor->phaseIndex[motor->currPhase]);
-
-	// set angle
-	motor->angle10 += motor->stepSize10*(direction*CLOCKWISE);
-	if(motor->angle10 < -3600)
-		motor->angle10 += 3600*2;
-	else if(motor->angle10 > 3600)
-		motor->angle10 -= 3600*2;
+	stepmotor_advance(motor, direction);
 	delay_ms(DEFAULT_DELAY);
 }
 
 void stepmotor_step_half_step(Stepmotor* motor, char direction) {
-	// if tmp = 0: turn on next one
-	// if tmp = 1: turn off previus one
-
-	if(motor->tmp == 0) {
-		// change current phase
-		motor->currPhase += direction;
-		_modulatePhase(motor);
-
-		// turn on next phase
-		*motor->port |=  (1<<motor->phaseIndex[motor->currPhase]);
-	}
-	else {
-		// change current phase
-		motor->currPhase -= direction;
-		_modulatePhase(motor);
-
-		// turn on next phase
-		*motor->port &= ~(1<<motor->phaseIndex[motor->currPhase]);
-
-		// change current phase
-		motor->currPhase += direction;
-		_modulatePhase(motor);
-
-		// set angle
-		motor->angle10 += motor->stepSize10*(direction*CLOCKWISE);
-		if(motor->angle10 < -3600)
-			motor->angle10 += 3600*2;
-		else if(motor->angle10 > 3600)
-			motor->angle10 -= 3600*2;
-			
+	stepmotor_advance(motor, direction);
+	delay_ms(DEFAULT_DELAY/2);
+}
 
+/**
+ * Move the stepmotor one step in its stepping scheme and return at once,
+ * for callers that time the steps themselves, like aatg/stepper.h
+ * @param {Stepmotor*} motor: motor to execute on
+ * @param {char} direction: CLOCKWISE or COUNTERCLOCKWISE
+ */
+void stepmotor_advance(Stepmotor* motor, char direction) {
+	if(direction == CLOCKWISE) {
+		motor->position++; // wraps at 8
+		motor->angle20 += motor->stepSize20;
+		if(motor->angle20 >= 7200)
+			motor->angle20 -= 7200;
+	} else {
+		motor->position--;
+		motor->angle20 -= motor->stepSize20;
+		if(motor->angle20 < 0)
+			motor->angle20 += 7200;
 	}
-	motor->tmp++;
-	motor->tmp %= 2;
-
-	delay_ms(DEFAULT_DELAY/2);
+	*motor->port = (*motor->port & ~motor->mask) | motor->table[motor->position];
 }
 
 //-----------------------------------------------------------------//
 
-// antager PIN-A = PB3
-// antager PIN-B = PB2
-
-void dcmotor_init() {
-	pwm0_init();
-	DDRB |= 1<<2;
+/**
+ * Take a DC motor from the pool and remember its pins
+ * The PWM pin has to be the output of a timer channel, set up in a PWM mode with aatg/timers.h,
+ * e.g. PORTD pin 6 and OCR0A for timer0 channel A
+ * @param {volatile uint8_t*} PWM_port: port of the PWM pin
+ * @param {unsigned char} PWM_pin: pin number 0-7
+ * @param {volatile uint8_t*} PWM_ocr: output compare register of that timer channel
+ * @param {volatile uint8_t*} direction_port: port of the direction pin
+ * @param {unsigned char} direction_pin: pin number 0-7
+ * @return {Dcmotor*} the motor, 0 if the pool is used up
+ */
+Dcmotor* dcmotor_new(volatile uint8_t* PWM_port, unsigned char PWM_pin, volatile uint8_t* PWM_ocr, volatile uint8_t* direction_port, unsigned char direction_pin) {
+	Dcmotor* motor;
+	if(_dcmotor_used >= DCMOTOR_POOL)
+		return 0;
+	motor = &_dcmotor_pool[_dcmotor_used++];
+	motor->PWM_port = PWM_port;
+	motor->PWM_pin = PWM_pin;
+	motor->PWM_ocr = PWM_ocr;
+	motor->direction_port = direction_port;
+	motor->direction_pin = direction_pin;
+	return motor;
 }
 
-void dcmotor_set_speed(int speed) {
-	// CounterClockwise
-	if(speed < 0)
-		PORTB |= 1<<2; 
-	// Clockwise
-	else
-		PORTB &= ~(1<<2);
+/**
+ * Make the motor's pins outputs and stop it
+ * @param {Dcmotor*} motor: motor to set up
+ */
+void dcmotor_init(Dcmotor* motor) {
+	// on every AVR the DDR register is the one just below the PORT register
+	*(motor->PWM_port - 1) |= 1<<motor->PWM_pin;
+	*(motor->direction_port - 1) |= 1<<motor->direction_pin;
+	dcmotor_set_speed(motor, 0);
+}
 
-	pwm0_set(speed);
+/**
+ * Set the speed and direction of a DC motor
+ * @param {Dcmotor*} motor: motor to drive
+ * @param {int} speed: -255 to 255, negative is counterclockwise, larger values are capped
+ */
+void dcmotor_set_speed(Dcmotor* motor, int speed) {
+	if(speed < 0) {
+		*motor->direction_port |= 1<<motor->direction_pin; // counterclockwise
+		speed = -speed;
+	} else {
+		*motor->direction_port &= ~(1<<motor->direction_pin); // clockwise
+	}
+	*motor->PWM_ocr = speed > 255 ? 255 : speed;
 }
 
 
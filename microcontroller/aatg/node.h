@@ -0,0 +1,186 @@
+ /**
+  * File:   node.h
+  *
+  * Description:
+  * 	Node addressing for several controllers sharing one serial link or radio.
+  * 	Commands can carry a "#<id>/" address prefix, e.g. "#3/S1:80 ", and every line
+  * 	printed through stdout gets the same prefix, so the host can tell the nodes apart.
+  * 	The node id is kept in EEPROM. Id 0 means unaddressed, the node then behaves as
+  * 	a single controller and prints no prefix. Frames addressed to 255 reach every node.
+  *
+  * 	Transmitting is time slotted: the frame is split in node_slots() slots and a node only
+  * 	transmits in slot id % slots. Slots are counted from the last sync, normally the host's
+  * 	heartbeat, which every node hears at the same time. The frame is the report period, stretched
+  * 	so every slot is at least slotMs wide, the airtime of a whole report. Anything a node sends,
+  * 	telemetry, events and replies, is only started if it fits in what is left of the slot, so a
+  * 	node never runs into the next node's slot. Before transmitting, a node also waits for the line
+  * 	to have been quiet for NODE_QUIET_MS, so it does not talk over a frame that is on its way in.
+  *
+  * Usage:
+  * 	Call 'node_init(frameMs, slotMs);' after 'usart_init();', frameMs being the report period and
+  * 	slotMs the airtime of a report at the link's baud rate.
+  * 	In the receive interrupt call 'node_heard(now);' for every byte and pass each complete
+  * 	frame to 'node_address(&frame);', which strips the address and returns 0 if the frame
+  * 	is for another node. Call 'node_sync(now);' on the frame that marks the slot start.
+  * 	Before each line or block of lines check 'node_can_send(now, ms)', ms being its airtime,
+  * 	e.g. NODE_LINE_MS for a single line.
+  *
+  */
+
+#ifndef __AATG_NODE__
+#define __AATG_NODE__
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "serial.h"
+
+#define NODE_UNADDRESSED 0
+#define NODE_BROADCAST 255
+#define NODE_QUIET_MS 3 // a few byte times at 9600 baud
+#define NODE_LINE_MS 40	// airtime of a line of up to 38 bytes at 9600 baud, prefix included
+
+void node_init(unsigned int frameMs, unsigned int slotMs);	// Loads id and slot count from EEPROM and prefixes stdout lines
+unsigned char node_id();							// This node's id, 0 if unaddressed
+void node_set_id(unsigned char id);					// Sets and stores the node id, 255 is not a valid id
+unsigned char node_slots();							// Number of telemetry slots per report period
+void node_set_slots(unsigned char n);				// Sets and stores the number of slots, 1 turns slotting off
+char node_address(char** frame);					// Strips the address of a frame, returns 0 if it is for another node
+void node_heard(unsigned long now);					// Marks the line busy, call for every byte received
+void node_sync(unsigned long now);					// Starts a new slot frame
+char node_clear_to_send(unsigned long now);			// 1 if the line has been quiet for NODE_QUIET_MS
+char node_in_slot(unsigned long now);				// 1 while this node's slot lasts
+unsigned int node_slot_left(unsigned long now);		// Milliseconds left of this node's slot, 0 outside it
+char node_can_send(unsigned long now, unsigned int ms);	// 1 if the line is quiet and ms of sending fit in the slot
+unsigned int node_frame_ms();						// Length of the slot frame, the report period or longer
+
+void _node_putchar(char data, FILE* stream);
+unsigned long _node_read(volatile unsigned long* v);
+
+uint8_t EEMEM _node_id_store = NODE_UNADDRESSED;
+uint8_t EEMEM _node_slots_store = 1;
+
+FILE node_output = FDEV_SETUP_STREAM(_node_putchar, NULL, _FDEV_SETUP_WRITE);
+
+unsigned char _node_id = NODE_UNADDRESSED;
+unsigned char _node_slots = 1;
+unsigned int _node_frame_ms = 0;
+unsigned int _node_slot_ms = 0;		// least slot width
+unsigned char _node_line_start = 1;	// next character starts a line
+volatile unsigned long _node_heard = 0;
+volatile unsigned long _node_sync = 0;
+
+
+void node_init(unsigned int frameMs, unsigned int slotMs) {
+	_node_frame_ms = frameMs;
+	_node_slot_ms = slotMs;
+	_node_id = eeprom_read_byte(&_node_id_store);
+	if(_node_id == NODE_BROADCAST) // erased EEPROM
+		_node_id = NODE_UNADDRESSED;
+	_node_slots = eeprom_read_byte(&_node_slots_store);
+	if(_node_slots == 0 || _node_slots == 0xFF)
+		_node_slots = 1;
+	_node_line_start = 1;
+	stdout = &node_output;
+}
+
+unsigned char node_id() {
+	return _node_id;
+}
+
+void node_set_id(unsigned char id) {
+	if(id == NODE_BROADCAST)
+		return;
+	_node_id = id;
+	eeprom_update_byte(&_node_id_store, id);
+}
+
+unsigned char node_slots() {
+	return _node_slots;
+}
+
+void node_set_slots(unsigned char n) {
+	_node_slots = n ? n : 1;
+	eeprom_update_byte(&_node_slots_store, _node_slots);
+}
+
+char node_address(char** frame) {
+	char* f = *frame;
+	char* end;
+	long id;
+	if(f[0] != '#')
+		return 1; // unaddressed frames reach every node
+	id = strtol(f+1, &end, 10);
+	if(end == f+1 || *end != '/')
+		return 0;
+	*frame = end+1;
+	return id == NODE_BROADCAST || id == _node_id;
+}
+
+void node_heard(unsigned long now) {
+	_node_heard = now;
+}
+
+void node_sync(unsigned long now) {
+	_node_sync = now;
+}
+
+char node_clear_to_send(unsigned long now) {
+	return now - _node_read(&_node_heard) >= NODE_QUIET_MS;
+}
+
+char node_in_slot(unsigned long now) {
+	return node_slot_left(now) > 0;
+}
+
+unsigned int node_slot_left(unsigned long now) {
+	unsigned int frame, width, at;
+	if(_node_slots <= 1 || _node_frame_ms == 0)
+		return 0xFFFF; // one node has the line to itself
+	frame = node_frame_ms();
+	width = frame / _node_slots;
+	at = (now - _node_read(&_node_sync)) % frame;
+	if(at / width != _node_id % _node_slots)
+		return 0;
+	return width - at % width;
+}
+
+char node_can_send(unsigned long now, unsigned int ms) {
+	return node_clear_to_send(now) && node_slot_left(now) >= ms;
+}
+
+unsigned int node_frame_ms() {
+	unsigned long least = (unsigned long)_node_slots * _node_slot_ms;
+	if(least > _node_frame_ms)
+		return least > 0xFFFF ? 0xFFFF : least;
+	return _node_frame_ms;
+}
+
+unsigned long _node_read(volatile unsigned long* v) {
+	// turn off interrupts while doing 32 bit read
+	unsigned char sreg;
+	unsigned long value;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	value = *v;
+	SREG = sreg; // restore global interrupt flag state
+	return value;
+}
+
+void _node_putchar(char data, FILE* stream) {
+	char id[4];
+	char* c;
+	if(_node_line_start && _node_id != NODE_UNADDRESSED) {
+		_usart_putchar('#', stream);
+		itoa(_node_id, id, 10);
+		for(c = id; *c; c++)
+			_usart_putchar(*c, stream);
+		_usart_putchar('/', stream);
+	}
+	_node_line_start = data == '\n';
+	_usart_putchar(data, stream);
+}
+
+#endif
@@ -0,0 +1,351 @@
+ /**
+  * File:   recorder.h
+  *
+  * Description:
+  * 	Flight data recorder, a circular log of timestamped records kept on a block device,
+  * 	so measurements survive while the host is disconnected.
+  * 	The device is split in blocks of RECORDER_BLOCK_SIZE bytes, each starting with a header:
+  * 		seq(16)		block sequence number, one more than the block before it
+  * 		used		payload bytes in use, 0xFF while the block is being started
+  * 		time(32)	clock in ms when the block was started
+  * 	followed by compressed records. Readings change slowly and records come at a steady rate,
+  * 	so each record holds the change in ms between records and, per channel, the change since
+  * 	the record before it, as zigzag varints:
+  * 		zigzag(v) = (v << 1) ^ (v >> 15), so small changes either way are small numbers
+  * 		varint: 7 bits per byte, least significant first, bit 7 set on every byte but the last
+  * 	The first record of a block is a keyframe, its time is the block time and its values are
+  * 	absolute, so every block can be decoded on its own and losing one to wrap-around costs no other.
+  * 	A steady reading or rate takes one byte instead of two. The header fields are little endian.
+  * 	The newest block is found again at boot as the one whose successor does not continue its
+  * 	sequence, and recording carries on in the block after it.
+  *
+  * 	Writes are queued and done one byte per 'recorder_run();', when the device is ready, so an
+  * 	EEPROM write (3.4 ms per byte) never blocks the caller. The used count of a block is written
+  * 	after its record, so a record cut short by a reset is never read back.
+  * 	Bytes that already hold the right value are not written. Wear is tracked as the bytes
+  * 	physically written against the record bytes logged, their ratio is the write amplification.
+  *
+  * Usage:
+  * 	Call 'recorder_init(&recorder_eeprom);' to record in EEPROM, or define RECORDER_RAM_SIZE
+  * 	before including this file and use 'recorder_ram' to record in RAM, e.g. when testing on a host.
+  * 	Log with 'recorder_log(now, values, n);' at the rate records are wanted and call
+  * 	'recorder_run();' from the main loop. 'recorder_describe();' prints the recorder state.
+  * 	To read the log back, 'recorder_snapshot();' fixes the blocks it holds, oldest first, and
+  * 	'recorder_snapshot_read(addr)' reads them as one run of 'recorder_snapshot_size()' bytes.
+  * 	The snapshot holds its blocks until 'recorder_release();': records go to blocks outside it
+  * 	and are dropped once there are none, so a slow download never mixes old and new blocks.
+  * 	After the release the snapshot stays readable until logging reaches one of its blocks,
+  * 	then 'recorder_snapshot_size()' is 0.
+  *
+  */
+
+#ifndef __AATG_RECORDER__
+#define __AATG_RECORDER__
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <stdio.h>
+
+#define RECORDER_BLOCK_SIZE 64
+#define RECORDER_HEADER 7
+#define RECORDER_PAYLOAD (RECORDER_BLOCK_SIZE - RECORDER_HEADER)
+#define RECORDER_EEPROM_SIZE 768	// what is left of the 1 KB EEPROM after scripts and config
+#define RECORDER_MAX_VALUES 8
+#define RECORDER_MAX_RECORD (3 + 3*RECORDER_MAX_VALUES) // 16 bit varints take up to 3 bytes
+#define RECORDER_QUEUE 48			// byte writes waiting for the device
+#define RECORDER_NONE 0xFF			// no block started yet
+
+typedef struct BlockDevice {
+	unsigned int size;									// bytes
+	unsigned char (*read)(unsigned int addr);
+	void (*write)(unsigned int addr, unsigned char value);
+	unsigned char (*ready)();							// 1 when a write can start without waiting
+} BlockDevice;
+
+void recorder_init(const BlockDevice* device);			// Finds the newest block on the device and continues after it
+unsigned char recorder_log(unsigned long now, int* values, unsigned char n); // Queues a record, returns 0 if it was dropped
+void recorder_run();									// Writes one queued byte if the device is ready
+void recorder_clear();									// Invalidates every block, queues a write per block
+unsigned char recorder_blocks();						// Number of blocks on the device
+unsigned char recorder_head();							// Block being filled, RECORDER_NONE if the log is empty
+unsigned int recorder_seq();							// Sequence number of the head block
+unsigned char recorder_idle();							// 1 when every queued byte has been written
+unsigned int recorder_snapshot();						// Fixes the blocks in the log for reading, returns their size in bytes
+unsigned int recorder_snapshot_size();					// Size of the last snapshot in bytes
+unsigned char recorder_snapshot_read(unsigned int addr);	// Byte addr of the snapshot, counted from the start of its oldest block
+void recorder_release();								// Lets logging write to the snapshot's blocks again
+void recorder_describe();								// Prints "D0:<blocks>,<head>,<seq>,<records>,<dropped>,<logged bytes>,<written bytes>"
+
+unsigned char _recorder_valid(unsigned char block);
+unsigned char _recorder_read(unsigned int addr);
+unsigned char _recorder_in_snapshot(unsigned char block);
+unsigned int _recorder_block_seq(unsigned char block);
+void _recorder_queue(unsigned int addr, unsigned char value);
+unsigned char _recorder_free();
+unsigned char _recorder_encode(unsigned char* out, unsigned int dt, int* values, unsigned char n, unsigned char keyframe);
+unsigned char _recorder_varint(unsigned char* out, unsigned int v);
+
+unsigned char _recorder_eeprom_read(unsigned int addr);
+void _recorder_eeprom_write(unsigned int addr, unsigned char value);
+unsigned char _recorder_eeprom_ready();
+
+uint8_t EEMEM _recorder_store[RECORDER_EEPROM_SIZE];
+const BlockDevice recorder_eeprom = {RECORDER_EEPROM_SIZE, _recorder_eeprom_read, _recorder_eeprom_write, _recorder_eeprom_ready};
+
+#ifdef RECORDER_RAM_SIZE
+unsigned char _recorder_ram[RECORDER_RAM_SIZE];
+unsigned char _recorder_ram_read(unsigned int addr)	{ return _recorder_ram[addr]; }
+void _recorder_ram_write(unsigned int addr, unsigned char value) { _recorder_ram[addr] = value; }
+unsigned char _recorder_ram_ready()						{ return 1; }
+const BlockDevice recorder_ram = {RECORDER_RAM_SIZE, _recorder_ram_read, _recorder_ram_write, _recorder_ram_ready};
+#endif
+
+const BlockDevice* _recorder_device = 0;
+unsigned char _recorder_blocks = 0;
+unsigned char _recorder_block = RECORDER_NONE;
+unsigned int  _recorder_seq = 0;
+unsigned char _recorder_used = 0;
+unsigned long _recorder_time = 0;
+// compressor state
+int _recorder_last[RECORDER_MAX_VALUES];	// values of the last record
+unsigned long _recorder_last_time = 0;
+unsigned int  _recorder_last_dt = 0;
+unsigned char _recorder_fresh = 1;			// next record starts a block
+// write queue
+unsigned int  _recorder_queue_addr[RECORDER_QUEUE];
+unsigned char _recorder_queue_value[RECORDER_QUEUE];
+unsigned char _recorder_queue_head = 0;
+unsigned char _recorder_queue_length = 0;
+// blocks being read back
+unsigned char _recorder_snapshot_oldest = 0;
+unsigned char _recorder_snapshot_blocks = 0;
+unsigned char _recorder_hold = 0;			// snapshot blocks may not be written
+// statistics since boot
+unsigned int  _recorder_records = 0;
+unsigned int  _recorder_dropped = 0;
+unsigned long _recorder_logged = 0;		// record bytes logged
+unsigned long _recorder_written = 0;	// bytes physically written, headers included
+
+
+void recorder_init(const BlockDevice* device) {
+	unsigned char i, next;
+	_recorder_device = device;
+	_recorder_blocks = device->size / RECORDER_BLOCK_SIZE;
+	_recorder_block = RECORDER_NONE;
+	_recorder_queue_length = 0;
+	_recorder_seq = 0;
+	_recorder_fresh = 1; // the clock and the last values are gone, start over with a keyframe
+	// the head is the valid block whose successor does not continue its sequence
+	for(i = 0; i < _recorder_blocks; i++) {
+		if(!_recorder_valid(i))
+			continue;
+		next = (i+1) % _recorder_blocks;
+		if(!_recorder_valid(next) || _recorder_block_seq(next) != (unsigned int)(_recorder_block_seq(i) + 1)) {
+			_recorder_block = i;
+			break;
+		}
+	}
+	if(_recorder_block == RECORDER_NONE)
+		return;
+	_recorder_seq = _recorder_block_seq(_recorder_block);
+	_recorder_used = device->read(_recorder_block*RECORDER_BLOCK_SIZE + 2);
+	_recorder_time = 0;
+	for(i = 0; i < 4; i++)
+		_recorder_time |= (unsigned long)device->read(_recorder_block*RECORDER_BLOCK_SIZE + 3 + i) << 8*i;
+}
+
+unsigned char recorder_log(unsigned long now, int* values, unsigned char n) {
+	unsigned char record[RECORDER_MAX_RECORD];
+	unsigned int addr;
+	unsigned char size, i;
+	unsigned int dt;
+	if(!_recorder_blocks)
+		return 0;
+	if(n > RECORDER_MAX_VALUES)
+		n = RECORDER_MAX_VALUES;
+	if(_recorder_free() < RECORDER_HEADER + RECORDER_MAX_RECORD + 1) {
+		_recorder_dropped++;
+		return 0;
+	}
+	size = 0;
+	dt = now - _recorder_last_time;
+	if(!_recorder_fresh && _recorder_block != RECORDER_NONE && now - _recorder_time <= 0xFFFF)
+		size = _recorder_encode(record, dt, values, n, 0);
+	if(_recorder_hold && _recorder_in_snapshot(_recorder_block))
+		size = 0; // the head is being read, continue in the next block
+	if(!size || _recorder_used + size > RECORDER_PAYLOAD) {
+		// start the next block, overwriting the oldest once the log has wrapped
+		i = _recorder_block == RECORDER_NONE ? 0 : (_recorder_block+1) % _recorder_blocks;
+		if(_recorder_in_snapshot(i)) {
+			if(_recorder_hold) {
+				_recorder_dropped++;
+				return 0;
+			}
+			_recorder_snapshot_blocks = 0; // about to change, a download has to start over
+		}
+		_recorder_block = i;
+		if(++_recorder_seq == 0xFFFF) // reserved for blocks never written
+			_recorder_seq = 0;
+		_recorder_used = 0;
+		_recorder_time = now;
+		addr = _recorder_block*RECORDER_BLOCK_SIZE;
+		_recorder_queue(addr + 2, 0xFF); // invalid until the first record is in
+		_recorder_queue(addr, _recorder_seq);
+		_recorder_queue(addr + 1, _recorder_seq >> 8);
+		for(i = 0; i < 4; i++)
+			_recorder_queue(addr + 3 + i, now >> 8*i);
+		dt = 0;
+		size = _recorder_encode(record, dt, values, n, 1);
+		_recorder_fresh = 0;
+	}
+	if(_recorder_in_snapshot(_recorder_block))
+		_recorder_snapshot_blocks = 0;
+	addr = _recorder_block*RECORDER_BLOCK_SIZE + RECORDER_HEADER + _recorder_used;
+	for(i = 0; i < size; i++)
+		_recorder_queue(addr++, record[i]);
+	for(i = 0; i < n; i++)
+		_recorder_last[i] = values[i];
+	_recorder_last_time = now;
+	_recorder_last_dt = dt;
+	_recorder_used += size;
+	_recorder_queue(_recorder_block*RECORDER_BLOCK_SIZE + 2, _recorder_used);
+	_recorder_records++;
+	_recorder_logged += size;
+	return 1;
+}
+
+void recorder_run() {
+	unsigned int addr;
+	unsigned char value;
+	if(!_recorder_queue_length || !_recorder_device->ready())
+		return;
+	addr = _recorder_queue_addr[_recorder_queue_head];
+	value = _recorder_queue_value[_recorder_queue_head];
+	_recorder_queue_head = (_recorder_queue_head+1) % RECORDER_QUEUE;
+	_recorder_queue_length--;
+	if(_recorder_device->read(addr) == value)
+		return; // saves a write and the wear
+	_recorder_device->write(addr, value);
+	_recorder_written++;
+}
+
+void recorder_clear() {
+	unsigned char i;
+	_recorder_queue_length = 0;
+	for(i = 0; i < _recorder_blocks; i++)
+		if(_recorder_valid(i))
+			_recorder_queue(i*RECORDER_BLOCK_SIZE + 2, 0xFF);
+	_recorder_block = RECORDER_NONE;
+	_recorder_fresh = 1;
+	_recorder_snapshot_blocks = 0;
+	_recorder_hold = 0;
+}
+
+unsigned char recorder_blocks() { return _recorder_blocks; }
+unsigned char recorder_head()   { return _recorder_block; }
+unsigned int  recorder_seq()    { return _recorder_seq; }
+unsigned char recorder_idle()   { return _recorder_queue_length == 0; }
+
+unsigned int recorder_snapshot() {
+	unsigned char next;
+	_recorder_snapshot_blocks = 0;
+	_recorder_hold = 0;
+	if(_recorder_block == RECORDER_NONE)
+		return 0;
+	// the block after the head is the oldest once the log has wrapped, else the log starts at block 0
+	next = (_recorder_block+1) % _recorder_blocks;
+	_recorder_snapshot_oldest = _recorder_valid(next) ? next : 0;
+	_recorder_snapshot_blocks = (_recorder_block + _recorder_blocks - _recorder_snapshot_oldest) % _recorder_blocks + 1;
+	_recorder_hold = 1;
+	return recorder_snapshot_size();
+}
+
+unsigned int recorder_snapshot_size() {
+	return _recorder_snapshot_blocks * RECORDER_BLOCK_SIZE;
+}
+
+unsigned char recorder_snapshot_read(unsigned int addr) {
+	unsigned char block = (_recorder_snapshot_oldest + addr / RECORDER_BLOCK_SIZE) % _recorder_blocks;
+	return _recorder_read(block*RECORDER_BLOCK_SIZE + addr % RECORDER_BLOCK_SIZE);
+}
+
+void recorder_release() {
+	_recorder_hold = 0;
+}
+
+void recorder_describe() {
+	printf("D0:%d,%d,%u,%u,%u,%lu,%lu\n", _recorder_blocks, _recorder_block, _recorder_seq,
+		_recorder_records, _recorder_dropped, _recorder_logged, _recorder_written);
+}
+
+unsigned char _recorder_valid(unsigned char block) {
+	unsigned int addr = block*RECORDER_BLOCK_SIZE;
+	return _recorder_read(addr + 2) <= RECORDER_PAYLOAD && _recorder_block_seq(block) != 0xFFFF;
+}
+
+unsigned int _recorder_block_seq(unsigned char block) {
+	unsigned int addr = block*RECORDER_BLOCK_SIZE;
+	return _recorder_read(addr) | (unsigned int)_recorder_read(addr + 1) << 8;
+}
+
+// the device as it will be once the queue is written, the newest queued value wins
+unsigned char _recorder_read(unsigned int addr) {
+	unsigned char i = _recorder_queue_length;
+	while(i--)
+		if(_recorder_queue_addr[(_recorder_queue_head + i) % RECORDER_QUEUE] == addr)
+			return _recorder_queue_value[(_recorder_queue_head + i) % RECORDER_QUEUE];
+	return _recorder_device->read(addr);
+}
+
+unsigned char _recorder_in_snapshot(unsigned char block) {
+	if(block == RECORDER_NONE)
+		return 0;
+	return (block + _recorder_blocks - _recorder_snapshot_oldest) % _recorder_blocks < _recorder_snapshot_blocks;
+}
+
+unsigned char _recorder_encode(unsigned char* out, unsigned int dt, int* values, unsigned char n, unsigned char keyframe) {
+	unsigned char size, i;
+	int v;
+	v = keyframe ? dt : dt - _recorder_last_dt;
+	size = _recorder_varint(out, (unsigned int)v << 1 ^ (unsigned int)(v >> 15));
+	for(i = 0; i < n; i++) {
+		v = keyframe ? values[i] : values[i] - _recorder_last[i];
+		size += _recorder_varint(out + size, (unsigned int)v << 1 ^ (unsigned int)(v >> 15));
+	}
+	return size;
+}
+
+unsigned char _recorder_varint(unsigned char* out, unsigned int v) {
+	unsigned char size = 0;
+	while(v > 0x7F) {
+		out[size++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	out[size++] = v;
+	return size;
+}
+
+void _recorder_queue(unsigned int addr, unsigned char value) {
+	unsigned char i = (_recorder_queue_head + _recorder_queue_length) % RECORDER_QUEUE;
+	_recorder_queue_addr[i] = addr;
+	_recorder_queue_value[i] = value;
+	_recorder_queue_length++;
+}
+
+unsigned char _recorder_free() {
+	return RECORDER_QUEUE - _recorder_queue_length;
+}
+
+unsigned char _recorder_eeprom_read(unsigned int addr) {
+	return eeprom_read_byte(&_recorder_store[addr]);
+}
+
+void _recorder_eeprom_write(unsigned int addr, unsigned char value) {
+	eeprom_write_byte(&_recorder_store[addr], value);
+}
+
+unsigned char _recorder_eeprom_ready() {
+	return eeprom_is_ready();
+}
+
+#endif
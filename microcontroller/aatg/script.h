@@ -0,0 +1,207 @@
+ /**
+  * File:   script.h
+  *
+  * Description:
+  * 	Small bytecode interpreter for macro scripts stored in EEPROM.
+  * 	A script is a sequence of servo setpoints, waits and sensor conditioned jumps,
+  * 	so a whole burn sequence can be started with a single command.
+  *
+  * Usage:
+  * 	Set the functions used for servo output and sensor input with
+  * 	'script_set_output_function(func);' and 'script_set_input_function(func);'.
+  * 	Store a script with 'script_write(slot, offset, bytes, n);'.
+  * 	Control it with 'script_start(slot);', 'script_pause(now);', 'script_resume(now);' and 'script_abort();',
+  * 	and call 'script_run(clock_millis());' from the main loop to execute it.
+  *
+  * Instruction set (operands are single bytes unless noted, 16 bit operands are little endian):
+  * 	END                         stops the script
+  * 	SET   target value          sets servo target to value
+  * 	WAIT  ms(16)                waits ms milliseconds
+  * 	JUMP  addr                  continues at addr (offset within the slot)
+  * 	IFLT  channel value(16) addr jumps to addr if sensor channel reads less than value, a signed value
+  * 	IFGT  channel value(16) addr jumps to addr if sensor channel reads more than value, a signed value
+  * 	COUNT n                     loads the loop counter with n
+  * 	DJNZ  addr                  decrements the loop counter and jumps to addr unless it reached zero
+  *
+  */
+
+#ifndef __AATG_SCRIPT__
+#define __AATG_SCRIPT__
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "cmdqueue.h"
+
+#define SCRIPT_SLOTS 4
+#define SCRIPT_SLOT_SIZE 32
+#define SCRIPT_MAX_STEPS 8 // instructions executed per call to script_run, keeps the main loop responsive
+
+// opcodes
+#define SCRIPT_END		0
+#define SCRIPT_SET		1
+#define SCRIPT_WAIT		2
+#define SCRIPT_JUMP		3
+#define SCRIPT_IFLT		4
+#define SCRIPT_IFGT		5
+#define SCRIPT_COUNT	6
+#define SCRIPT_DJNZ		7
+
+// interpreter states
+#define SCRIPT_IDLE		0
+#define SCRIPT_RUNNING	1
+#define SCRIPT_PAUSED	2
+#define SCRIPT_ERROR	3
+
+typedef int (*pReadFunc)(unsigned char channel); // function returning the value of a sensor channel
+
+void script_set_output_function(pCmdFunc func);	// Sets function used by SET instructions
+void script_set_input_function(pReadFunc func);	// Sets function used by IFLT/IFGT instructions
+void script_write(unsigned char slot, unsigned char offset, unsigned char* bytes, unsigned char n); // Stores bytes in a script slot, only changed bytes are written
+void script_start(unsigned char slot);			// Starts the script in slot from the beginning
+void script_pause(unsigned long now);			// Pauses the running script
+void script_resume(unsigned long now);			// Resumes a paused script, pending waits continue where they left off
+void script_abort();							// Stops the script
+void script_run(unsigned long now);				// Executes instructions until a wait or SCRIPT_MAX_STEPS instructions
+unsigned char script_state();					// One of the interpreter states above
+unsigned char script_slot();					// Slot of the current or last script
+unsigned char script_pc();						// Offset of the next instruction
+
+unsigned char _script_fetch();
+
+uint8_t EEMEM _script_store[SCRIPT_SLOTS][SCRIPT_SLOT_SIZE];
+
+pCmdFunc  _script_output_function = 0;
+pReadFunc _script_input_function = 0;
+unsigned char _script_state = SCRIPT_IDLE;
+unsigned char _script_slot = 0;
+unsigned char _script_pc = 0;
+unsigned char _script_counter = 0;
+unsigned char _script_waiting = 0;
+unsigned long _script_wait_until = 0;
+unsigned long _script_wait_left = 0;	// remaining wait while paused
+
+
+void script_set_output_function(pCmdFunc func) {
+	_script_output_function = func;
+}
+
+void script_set_input_function(pReadFunc func) {
+	_script_input_function = func;
+}
+
+void script_write(unsigned char slot, unsigned char offset, unsigned char* bytes, unsigned char n) {
+	if(slot >= SCRIPT_SLOTS)
+		return;
+	// abort a script that is being overwritten
+	if(slot == _script_slot && _script_state != SCRIPT_IDLE)
+		script_abort();
+	while(n-- && offset < SCRIPT_SLOT_SIZE)
+		eeprom_update_byte(&_script_store[slot][offset++], *bytes++);
+}
+
+void script_start(unsigned char slot) {
+	if(slot >= SCRIPT_SLOTS)
+		return;
+	_script_slot = slot;
+	_script_pc = 0;
+	_script_counter = 0;
+	_script_waiting = 0;
+	_script_state = SCRIPT_RUNNING;
+}
+
+void script_pause(unsigned long now) {
+	if(_script_state != SCRIPT_RUNNING)
+		return;
+	if(_script_waiting)
+		_script_wait_left = (long)(_script_wait_until - now) > 0 ? _script_wait_until - now : 0;
+	_script_state = SCRIPT_PAUSED;
+}
+
+void script_resume(unsigned long now) {
+	if(_script_state != SCRIPT_PAUSED)
+		return;
+	if(_script_waiting)
+		_script_wait_until = now + _script_wait_left;
+	_script_state = SCRIPT_RUNNING;
+}
+
+void script_abort() {
+	_script_state = SCRIPT_IDLE;
+	_script_waiting = 0;
+}
+
+unsigned char script_state() { return _script_state; }
+unsigned char script_slot()  { return _script_slot; }
+unsigned char script_pc()    { return _script_pc; }
+
+unsigned char _script_fetch() {
+	if(_script_pc >= SCRIPT_SLOT_SIZE) {
+		_script_state = SCRIPT_ERROR;
+		return SCRIPT_END;
+	}
+	return eeprom_read_byte(&_script_store[_script_slot][_script_pc++]);
+}
+
+void script_run(unsigned long now) {
+	unsigned char steps = SCRIPT_MAX_STEPS;
+	unsigned char op, a, b;
+	int value;
+
+	if(_script_state != SCRIPT_RUNNING)
+		return;
+	if(_script_waiting) {
+		if((long)(now - _script_wait_until) < 0)
+			return;
+		_script_waiting = 0;
+	}
+
+	while(steps-- && _script_state == SCRIPT_RUNNING) {
+		op = _script_fetch();
+		switch(op) {
+			case SCRIPT_END:
+				if(_script_state == SCRIPT_RUNNING)
+					_script_state = SCRIPT_IDLE;
+				return;
+			case SCRIPT_SET:
+				a = _script_fetch();
+				b = _script_fetch();
+				if(_script_output_function)
+					_script_output_function(a, b);
+				break;
+			case SCRIPT_WAIT:
+				a = _script_fetch();
+				b = _script_fetch();
+				_script_wait_until = now + (a | (unsigned int)b<<8);
+				_script_waiting = 1;
+				return;
+			case SCRIPT_JUMP:
+				_script_pc = _script_fetch();
+				break;
+			case SCRIPT_IFLT:
+			case SCRIPT_IFGT:
+				a = _script_fetch();
+				value = _script_fetch();
+				value = (int16_t)(value | (unsigned int)_script_fetch()<<8); // two's complement
+				b = _script_fetch();
+				if(!_script_input_function)
+					break;
+				if(op == SCRIPT_IFLT ? _script_input_function(a) < value : _script_input_function(a) > value)
+					_script_pc = b;
+				break;
+			case SCRIPT_COUNT:
+				_script_counter = _script_fetch();
+				break;
+			case SCRIPT_DJNZ:
+				a = _script_fetch();
+				if(_script_counter && --_script_counter)
+					_script_pc = a;
+				break;
+			default:
+				_script_state = SCRIPT_ERROR;
+				return;
+		}
+	}
+}
+
+#endif
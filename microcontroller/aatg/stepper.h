@@ -0,0 +1,352 @@
+ /**
+  * File:   stepper.h
+  *
+  * Description:
+  * 	Interrupt driven stepper motor moves with trapezoidal speed ramps, for up to STEPPER_AXES motors at once.
+  * 	Occupies timer2 and its Output Compare Match A interrupt, counting at F_CPU/256, 16 us at 16 MHz.
+  * 	A move accelerates to the top speed, runs and decelerates to stop on the target.
+  * 	The axis with the most steps follows the ramp and the others are spread over its steps with
+  * 	Bresenham's line algorithm, all in integers, so every axis arrives at the same time.
+  * 	The motors step into a copy of their port in RAM and the interrupt then writes each port
+  * 	once, so coils switching together on one port switch in the same instant.
+  * 	The delay between steps follows the integer approximation of Atmel's AVR446 application note:
+  * 		c0 = 0.676 * f * sqrt(2/accel)
+  * 		cn = cn-1 - 2*cn-1 / (4n + 1)
+  * 	with n counting up while accelerating and from minus the ramp length up to 0 while decelerating.
+  * 	Each delay is worked out one step ahead, so the interrupt steps first and the timing
+  * 	never depends on how long the arithmetic takes. Delays longer than the 8 bit timer
+  * 	holds are counted out in parts.
+  *
+  * Usage:
+  * 	Set the motor up with 'stepmotor_init' from motorControl.h and call 'stepper_init(motor);',
+  * 	then 'stepper_set_speed(speed, accel);' in steps/s and steps/s^2, and enable global interrupts.
+  * 	'stepper_move_to(position);' and 'stepper_move(steps);' start a move and return at once.
+  * 	'stepper_position()' and 'stepper_busy()' can be read at any time, 'stepper_stop();' ramps down early.
+  * 	More motors are added as axes 1 and up with 'stepper_add(motor);'. From then on the motor belongs
+  * 	to this file, do not step it with the functions in motorControl.h.
+  * 	'stepper_move_axes(steps);' and 'stepper_move_axes_to(positions);' move all axes together, taking
+  * 	an array with an entry per axis, and 'stepper_axis_position(axis)' reads one axis.
+  *
+  */
+
+#ifndef __AATG_STEPPER__
+#define __AATG_STEPPER__
+
+#include <avr/io.h>
+
+#include "timers.h"
+#include "interrupts.h"
+#include "motorControl.h"
+
+#define STEPPER_FREQ (F_CPU/256)	// timer2 counts per second
+#define STEPPER_MIN_DELAY 16		// shortest step delay in counts, 3900 steps/s, leaves time for the interrupt
+#define STEPPER_FIRST_DELAY 16		// counts from starting a move to its first step
+#define STEPPER_AXES 4
+#define STEPPER_NONE 0xFF
+
+// ramp states
+#define STEPPER_STOP 0
+#define STEPPER_ACCEL 1
+#define STEPPER_RUN 2
+#define STEPPER_DECEL 3
+
+void stepper_init(Stepmotor* motor);						// Takes timer2 and drives motor as axis 0
+unsigned char stepper_add(Stepmotor* motor);				// Adds motor as the next axis, returns its number or STEPPER_NONE
+void stepper_set_speed(unsigned int speed, unsigned int accel);	// Top speed in steps/s and acceleration in steps/s^2 of the longest axis
+bool stepper_move(long steps);								// Starts moving axis 0 steps from here, negative counterclockwise, false while busy
+bool stepper_move_to(long position);						// Starts moving axis 0 to position, false while busy
+bool stepper_move_axes(long* steps);						// Starts moving every axis its steps, arriving together, false while busy
+bool stepper_move_axes_to(long* positions);					// Starts moving every axis to its position, arriving together
+void stepper_stop();										// Decelerates to a stop as soon as possible
+long stepper_position();									// Steps of axis 0 from position 0, counting the ones taken so far
+long stepper_axis_position(unsigned char axis);				// Steps of an axis from position 0
+void stepper_set_position(long position);					// Renames where axis 0 stands, only while not busy
+bool stepper_busy();										// True while moving
+
+void _stepper_tick();
+void _stepper_next_chunk();
+unsigned long _stepper_isqrt(unsigned long x);
+
+Stepmotor* _stepper_motor[STEPPER_AXES];
+unsigned char _stepper_axes = 0;
+volatile uint8_t* _stepper_port[STEPPER_AXES];		// the motors' ports
+volatile uint8_t _stepper_shadow[STEPPER_AXES];		// what the motors step, copied to the ports
+unsigned char _stepper_mask[STEPPER_AXES];			// pins of each port that belong to motors
+unsigned char _stepper_ports = 0;
+unsigned int _stepper_speed = 200;
+unsigned int _stepper_accel = 400;
+
+volatile unsigned char _stepper_state = STEPPER_STOP;
+volatile long _stepper_position[STEPPER_AXES];
+signed char _stepper_dir[STEPPER_AXES];
+unsigned long _stepper_delta[STEPPER_AXES];	// steps of each axis in the move
+unsigned long _stepper_error[STEPPER_AXES];	// Bresenham error of each axis
+unsigned long _stepper_total = 0;		// steps of the longest axis, the ramp's steps
+unsigned long _stepper_steps = 0;		// steps until the end of the ramp, shortened by a stop
+unsigned long _stepper_count = 0;		// steps taken in the move
+unsigned long _stepper_decel_start = 0;	// step at which deceleration starts
+long _stepper_decel_val = 0;			// n at the start of the deceleration, negative
+long _stepper_n = 0;					// ramp step counter, n in the formula
+unsigned long _stepper_delay = 0;		// counts until the next step
+unsigned long _stepper_min_delay = 0;	// delay at top speed
+unsigned long _stepper_last_accel = 0;	// delay the acceleration ended with
+unsigned long _stepper_rest = 0;		// remainder carried between delays, keeps the ramp exact
+unsigned long _stepper_wait = 0;		// counts of the current delay not yet handed to the timer
+
+
+void stepper_init(Stepmotor* motor) {
+	_stepper_axes = _stepper_ports = 0;
+	_stepper_state = STEPPER_STOP;
+	timer2_init(CLEAR_ON_COMPARE, NON_PWM_NORMAL, NON_PWM_NORMAL, CLOCK2_PRESCALER_256);
+	timer2_set_output_compareA_interrupt_function(_stepper_tick);
+	stepper_add(motor);
+}
+
+unsigned char stepper_add(Stepmotor* motor) {
+	unsigned char p;
+	if(_stepper_axes >= STEPPER_AXES || _stepper_state != STEPPER_STOP)
+		return STEPPER_NONE;
+	// motors sharing a port share its copy
+	for(p = 0; p < _stepper_ports && _stepper_port[p] != motor->port; p++);
+	if(p == _stepper_ports) {
+		_stepper_port[p] = motor->port;
+		_stepper_shadow[p] = *motor->port;
+		_stepper_mask[p] = 0;
+		_stepper_ports++;
+	}
+	_stepper_mask[p] |= motor->mask;
+	motor->port = &_stepper_shadow[p]; // from now on the motor steps the copy
+	_stepper_motor[_stepper_axes] = motor;
+	_stepper_position[_stepper_axes] = 0;
+	return _stepper_axes++;
+}
+
+void stepper_set_speed(unsigned int speed, unsigned int accel) {
+	_stepper_speed = speed ? speed : 1;
+	_stepper_accel = accel ? accel : 1;
+}
+
+bool stepper_move(long steps) {
+	long axes[STEPPER_AXES] = {0};
+	axes[0] = steps;
+	return stepper_move_axes(axes);
+}
+
+bool stepper_move_axes(long* steps) {
+	unsigned long max_s_lim, accel_lim;
+	unsigned char a;
+	if(_stepper_state != STEPPER_STOP)
+		return false;
+	// the interrupt may still be armed from the last move, keep it out until the new one is set up
+	timer2_output_compareA_interrupt_disable();
+	_stepper_total = 0;
+	for(a = 0; a < _stepper_axes; a++) {
+		_stepper_dir[a] = steps[a] < 0 ? COUNTERCLOCKWISE : CLOCKWISE;
+		_stepper_delta[a] = steps[a] < 0 ? -steps[a] : steps[a];
+		if(_stepper_delta[a] > _stepper_total)
+			_stepper_total = _stepper_delta[a];
+	}
+	if(_stepper_total == 0)
+		return true;
+	for(a = 0; a < _stepper_axes; a++)
+		_stepper_error[a] = _stepper_total/2; // spreads the steps evenly
+	_stepper_steps = _stepper_total;
+	_stepper_count = 0;
+	_stepper_n = 0;
+	_stepper_rest = 0;
+	_stepper_min_delay = STEPPER_FREQ / _stepper_speed;
+	if(_stepper_min_delay < STEPPER_MIN_DELAY)
+		_stepper_min_delay = STEPPER_MIN_DELAY;
+
+	if(_stepper_steps == 1) {
+		// a single step, no ramp
+		_stepper_n = -1;
+		_stepper_delay = _stepper_min_delay;
+		_stepper_decel_start = 0;
+		_stepper_state = STEPPER_DECEL;
+	} else {
+		// c0 = 0.676 * f * sqrt(2/accel), sqrt(2/accel) taken as sqrt(2000000/accel)/1000
+		_stepper_delay = (STEPPER_FREQ*676/1000) * _stepper_isqrt(2000000UL/_stepper_accel) / 1000;
+		// steps to reach top speed, v^2/(2a), and where deceleration has to start
+		max_s_lim = (unsigned long)_stepper_speed*_stepper_speed / (2UL*_stepper_accel);
+		if(max_s_lim == 0)
+			max_s_lim = 1;
+		accel_lim = _stepper_steps/2; // acceleration and deceleration are the same
+		if(accel_lim == 0)
+			accel_lim = 1;
+		if(accel_lim <= max_s_lim)
+			_stepper_decel_val = (long)accel_lim - (long)_stepper_steps; // top speed is never reached
+		else
+			_stepper_decel_val = -(long)max_s_lim;
+		if(_stepper_decel_val == 0)
+			_stepper_decel_val = -1;
+		_stepper_decel_start = _stepper_steps + _stepper_decel_val;
+		if(_stepper_delay <= _stepper_min_delay) {
+			_stepper_delay = _stepper_last_accel = _stepper_min_delay;
+			_stepper_state = STEPPER_RUN;
+		} else {
+			_stepper_state = STEPPER_ACCEL;
+		}
+	}
+
+	// first step shortly, the ramp's first delay follows it, armed last
+	_stepper_wait = 0;
+	timer2_set_counter(0);
+	timer2_set_output_compare_registerA(STEPPER_FIRST_DELAY - 1);
+	TIFR2 = 1<<OCF2A; // a match from while it was off would step at once
+	timer2_output_compareA_interrupt_enable();
+	return true;
+}
+
+bool stepper_move_to(long position) {
+	return stepper_move(position - stepper_position());
+}
+
+bool stepper_move_axes_to(long* positions) {
+	long steps[STEPPER_AXES];
+	unsigned char a;
+	for(a = 0; a < _stepper_axes; a++)
+		steps[a] = positions[a] - stepper_axis_position(a);
+	return stepper_move_axes(steps);
+}
+
+void stepper_stop() {
+	unsigned char sreg;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	switch(_stepper_state) {
+		case STEPPER_ACCEL:
+			// as many steps down as were taken up
+			_stepper_decel_val = -_stepper_n;
+			_stepper_decel_start = _stepper_count;
+			_stepper_steps = _stepper_count + 1 + _stepper_n;
+			break;
+		case STEPPER_RUN:
+			_stepper_decel_start = _stepper_count;
+			_stepper_steps = _stepper_count + 1 - _stepper_decel_val;
+			break;
+	}
+	SREG = sreg; // restore global interrupt flag state
+}
+
+long stepper_position() {
+	return stepper_axis_position(0);
+}
+
+long stepper_axis_position(unsigned char axis) {
+	long position;
+	unsigned char sreg;
+	if(axis >= _stepper_axes)
+		return 0;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	position = _stepper_position[axis];
+	SREG = sreg; // restore global interrupt flag state
+	return position;
+}
+
+void stepper_set_position(long position) {
+	if(_stepper_state == STEPPER_STOP)
+		_stepper_position[0] = position;
+}
+
+bool stepper_busy() {
+	return _stepper_state != STEPPER_STOP;
+}
+
+// timer2 compare match, steps when the delay has run out
+void _stepper_tick() {
+	unsigned long delay;
+	unsigned char a;
+	if(_stepper_wait) {
+		_stepper_next_chunk();
+		return;
+	}
+	if(_stepper_state == STEPPER_STOP) {
+		timer2_output_compareA_interrupt_disable();
+		return;
+	}
+
+	// Bresenham, the longest axis steps every time and the others when their error overflows
+	for(a = 0; a < _stepper_axes; a++) {
+		_stepper_error[a] += _stepper_delta[a];
+		if(_stepper_error[a] >= _stepper_total) {
+			_stepper_error[a] -= _stepper_total;
+			stepmotor_advance(_stepper_motor[a], _stepper_dir[a]);
+			_stepper_position[a] += _stepper_dir[a];
+		}
+	}
+	// one store per port
+	for(a = 0; a < _stepper_ports; a++)
+		*_stepper_port[a] = (*_stepper_port[a] & ~_stepper_mask[a]) | (_stepper_shadow[a] & _stepper_mask[a]);
+	_stepper_count++;
+	_stepper_wait = _stepper_delay; // worked out on the step before
+
+	// the delay after the next step, AVR446
+	delay = _stepper_delay;
+	switch(_stepper_state) {
+		case STEPPER_ACCEL:
+			_stepper_n++;
+			delay = _stepper_delay - (2*_stepper_delay + _stepper_rest)/(4*_stepper_n + 1);
+			_stepper_rest = (2*_stepper_delay + _stepper_rest)%(4*_stepper_n + 1);
+			if(_stepper_count >= _stepper_decel_start) {
+				_stepper_n = _stepper_decel_val;
+				_stepper_state = STEPPER_DECEL;
+			} else if(delay <= _stepper_min_delay) {
+				_stepper_last_accel = delay;
+				delay = _stepper_min_delay;
+				_stepper_rest = 0;
+				_stepper_state = STEPPER_RUN;
+			}
+			break;
+		case STEPPER_RUN:
+			delay = _stepper_min_delay;
+			if(_stepper_count >= _stepper_decel_start) {
+				_stepper_n = _stepper_decel_val;
+				delay = _stepper_last_accel;
+				_stepper_state = STEPPER_DECEL;
+			}
+			break;
+		case STEPPER_DECEL:
+			_stepper_n++;
+			if(_stepper_n >= 0 || _stepper_count >= _stepper_steps) {
+				_stepper_state = STEPPER_STOP; // the next tick turns the interrupt off
+				break;
+			}
+			// n is negative, so the delay grows
+			delay = _stepper_delay + (2*_stepper_delay + _stepper_rest)/(-4*_stepper_n - 1);
+			_stepper_rest = (2*_stepper_delay + _stepper_rest)%(-4*_stepper_n - 1);
+			break;
+	}
+	_stepper_delay = delay;
+	_stepper_next_chunk();
+}
+
+// hands the timer the next part of the delay, at most 256 counts
+void _stepper_next_chunk() {
+	unsigned int chunk = 256;
+	if(_stepper_wait <= 256)
+		chunk = _stepper_wait;
+	else if(_stepper_wait < 256 + STEPPER_MIN_DELAY)
+		chunk = 128; // so the last part is not too short to catch
+	_stepper_wait -= chunk;
+	timer2_set_output_compare_registerA(chunk - 1);
+}
+
+unsigned long _stepper_isqrt(unsigned long x) {
+	unsigned long root = 0, bit = 1UL << 30;
+	while(bit > x)
+		bit >>= 2;
+	while(bit) {
+		if(x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+#endif
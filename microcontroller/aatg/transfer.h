@@ -0,0 +1,132 @@
+ /**
+  * File:   transfer.h
+  *
+  * Description:
+  * 	Windowed bulk transfer, used to download the flight recorder log.
+  * 	The data is sent in chunks of TRANSFER_CHUNK bytes, one line each:
+  * 		D5:<seq>,<hex data>,<crc>
+  * 	seq is the chunk number and crc the CRC16 (avr-libc _crc16_update, start 0xFFFF) of
+  * 	the two seq bytes, low first, and the data, in hex. Up to TRANSFER_WINDOW chunks are sent ahead of
+  * 	the host's acknowledgement, which holds the number of the next chunk it is missing.
+  * 	Without acknowledgement for TRANSFER_TIMEOUT_MS the window is sent again, and after
+  * 	TRANSFER_RETRIES such timeouts the transfer gives up, so a lost link ends it. The host
+  * 	resumes by starting again at the first chunk it is missing.
+  * 	At most one chunk goes out per TRANSFER_INTERVAL_MS, leaving room for live telemetry,
+  * 	and a chunk is a short line, so the main loop is never held up for long.
+  *
+  * Usage:
+  * 	'transfer_start(read, size, from, now);' starts sending size bytes from chunk from,
+  * 	bytes are read with read(addr). Pass acknowledgements to 'transfer_ack(next, now);' and call
+  * 	'transfer_run(now);' from the main loop when it may transmit.
+  * 	"D3:<chunks>" is printed when the host has acknowledged every chunk.
+  *
+  */
+
+#ifndef __AATG_TRANSFER__
+#define __AATG_TRANSFER__
+
+#include <avr/io.h>
+#include <util/crc16.h>
+#include <stdio.h>
+
+#define TRANSFER_CHUNK 8
+#define TRANSFER_WINDOW 4
+#define TRANSFER_INTERVAL_MS 100
+#define TRANSFER_TIMEOUT_MS 1500
+#define TRANSFER_RETRIES 5
+
+typedef unsigned char (*pTransferRead)(unsigned int addr);
+
+void transfer_start(pTransferRead read, unsigned int size, unsigned int from, unsigned long now); // Starts or resumes a transfer at chunk from
+void transfer_ack(unsigned int next, unsigned long now);	// The host has every chunk below next
+void transfer_stop();										// Ends the transfer
+unsigned char transfer_active();							// 1 while a transfer is running
+unsigned int transfer_chunks();								// Number of chunks in the transfer
+void transfer_run(unsigned long now);						// Sends the next chunk if one is due
+
+void _transfer_send(unsigned int seq);
+
+pTransferRead _transfer_read = 0;
+unsigned char _transfer_active = 0;
+unsigned int  _transfer_chunks = 0;
+unsigned int  _transfer_size = 0;
+unsigned int  _transfer_acked = 0;	// first chunk not acknowledged
+unsigned int  _transfer_next = 0;	// next chunk to send
+unsigned char _transfer_retries = 0;
+unsigned long _transfer_sent = 0;	// time of the last chunk sent
+unsigned long _transfer_progress = 0;	// time the window last moved
+
+
+void transfer_start(pTransferRead read, unsigned int size, unsigned int from, unsigned long now) {
+	_transfer_read = read;
+	_transfer_size = size;
+	_transfer_chunks = (size + TRANSFER_CHUNK - 1) / TRANSFER_CHUNK;
+	_transfer_acked = _transfer_next = from > _transfer_chunks ? _transfer_chunks : from;
+	_transfer_retries = 0;
+	_transfer_sent = now - TRANSFER_INTERVAL_MS;
+	_transfer_progress = now;
+	_transfer_active = 1;
+}
+
+void transfer_ack(unsigned int next, unsigned long now) {
+	if(!_transfer_active || next <= _transfer_acked || next > _transfer_chunks)
+		return;
+	_transfer_acked = next;
+	if(_transfer_next < next)
+		_transfer_next = next;
+	_transfer_retries = 0;
+	_transfer_progress = now;
+}
+
+void transfer_stop() {
+	_transfer_active = 0;
+}
+
+unsigned char transfer_active() {
+	return _transfer_active;
+}
+
+unsigned int transfer_chunks() {
+	return _transfer_chunks;
+}
+
+void transfer_run(unsigned long now) {
+	if(!_transfer_active)
+		return;
+	if(_transfer_acked >= _transfer_chunks) {
+		printf("D3:%u\n", _transfer_chunks);
+		_transfer_active = 0;
+		return;
+	}
+	if(now - _transfer_progress >= TRANSFER_TIMEOUT_MS) {
+		if(++_transfer_retries > TRANSFER_RETRIES) {
+			_transfer_active = 0; // link lost, the host resumes when it is back
+			return;
+		}
+		_transfer_next = _transfer_acked; // go back and send the window again
+		_transfer_progress = now;
+	}
+	if(now - _transfer_sent < TRANSFER_INTERVAL_MS)
+		return;
+	if(_transfer_next >= _transfer_chunks || _transfer_next >= _transfer_acked + TRANSFER_WINDOW)
+		return; // window full, wait for the host
+	_transfer_send(_transfer_next++);
+	_transfer_sent = now;
+}
+
+void _transfer_send(unsigned int seq) {
+	unsigned int addr = seq * TRANSFER_CHUNK;
+	unsigned int crc = 0xFFFF;
+	unsigned char i, b;
+	crc = _crc16_update(crc, seq);
+	crc = _crc16_update(crc, seq >> 8);
+	printf("D5:%u,", seq);
+	for(i = 0; i < TRANSFER_CHUNK && addr < _transfer_size; i++, addr++) {
+		b = _transfer_read(addr);
+		crc = _crc16_update(crc, b);
+		printf("%02x", b);
+	}
+	printf(",%04x\n", crc);
+}
+
+#endif
@@ -1,16 +1,49 @@
 // Standard libs
 #include <avr/io.h>
 #include <util/delay.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 
 #include "aatg/essentials.h"
 #include "aatg/interrupts.h"
 #include "aatg/serial.h"
 #include "aatg/adc.h"
 #include "aatg/timers.h"
+#include "aatg/clock.h"
+#include "aatg/cmdqueue.h"
+#include "aatg/script.h"
+#include "aatg/channels.h"
+#include "aatg/node.h"
+#include "aatg/config.h"
+#include "aatg/recorder.h"
+#include "aatg/transfer.h"
+#include "aatg/memory.h"
+#ifdef FLIGHT_LCD
+#ifndef LCDPORT
+#error "FLIGHT_LCD needs the display's wiring, see the flight display notes below"
+#endif
+#include "aatg/lcdqueue.h"
+#include "aatg/lcdbuf.h"
+#endif
 
-#define INACTIVE_LOOPS 4
+#define CONFIG_VERSION 2		// bump when struct Config changes
+#define HEARTBEAT_MS 250		// default heartbeat interval
+#define HEARTBEAT_MIN_MS 100
+#define HEARTBEAT_MAX_MS 5000
+#define KEEPALIVE_MISSES 4		// default heartbeat intervals without a frame before the link counts as lost
+#define RECORD_MS 1000			// default flight recorder period
+#define RECORD_MIN_MS 100		// shortest recorder period, so logging cannot starve the main loop
+#define REPORT_MS 250
+#define REPORT_AIR_MS 260		// a full report at 9600 baud: Z1, K1, 8 channel lines and X, about 250 bytes with "#<id>/" prefixes
+#define SAMPLE_MS 10			// channels are sampled from the clock tick, so printing a report does not hold them up
+#define STATUS_MS 250			// flight display, one row is redrawn per interval
+#define BATTERY_MV_TOP 9200		// P1 reading 1023
+#define UPLOAD_MAX 16
+#define ECHO_MAX 16
 #define Ts 2
 #define Ss 3
+#define SERVO_NONE -1			// no setpoint, the servo is not driven
 
 #define RGBR 7
 #define RGBG 6
@@ -51,51 +84,530 @@
 // From 758 - 2478
 // 200 degrees
 
+//
+// servo commands
+//
+// S1:80 			set S1 to 80 now
+// S1:80+1500 		set S1 to 80 for 1500 ms, then back to the setpoint it had when the command arrived
+// S2:100@500 		set S2 to 100 500 ms from now
+// S1:80@200+1500	the two combined
+// timed commands are run from the clock interrupt, so their timing does not depend on link latency
+// a timed command the queue has no room for is dropped whole and counted as a parse error
+// losing the link forgets every setpoint, so an old one is never driven again when the link returns
+
+//
+// script commands
+//
+// W0:4,0150 		stores the bytes 0x01 0x50 at offset 4 of script slot 0, acknowledged with "W0:4,2" once written
+// X0:1 			starts script 0, X0:0 aborts, X0:2 pauses and X0:3 resumes it
+// scripts are assembled on the host, see www/js/scriptasm.js
+
+//
+// link commands
+//
+// E1:<host time> 	echo, answered with "E1:<host time>,<echo sequence number>,<received>,<sent>"
+// 					received and sent are the device clock in ms when the echo arrived and when the answer left,
+// 					so the host can estimate clock offset and drift as NTP does, see www/js/clocksync.js
+// L1:0 			link statistics, answered with "L1:<bytes received>,<frames parsed>,<parse errors>,<overruns>,<echo sequence number>"
+// H 				heartbeat, keeps the link alive without changing anything
+// H1:<ms> 		proposes a heartbeat interval, answered with the interval accepted
+// replies are sent from the main loop, so printing never blocks the receive interrupt
+// the link is lost after config.keepaliveMisses heartbeat intervals without a valid frame,
+// so the host only needs to send setpoints when they change
+
+//
+// channel commands
+//
+// C0:0 			number of channels, answered with "C0:<count>"
+// C1:<index> 		channel descriptor, answered with "C1:<index>,<name>,<source>,<pin>,<mul>,<div>,<offset>,<filter>,<rate>,<value>"
+// R<type>:<index>,<level>,<hysteresis>	sets the trigger rule of a channel, type 0 none, 1 above, 2 below, 3 delta
+// 					a delta rule needs a level above 0, invalid rules are counted as parse errors
+// 					rules are checked on every sample, every SAMPLE_MS even while a report is being sent, and a
+// 					triggered rule sends "!<name>:<value>" once the line is free, ahead of routine telemetry
+// K1:<n> 			delta telemetry with a keyframe every n reports, 0 for full reports only, see aatg/channels.h
+// every report starts with "Z1:<ms>", the device clock when the reported samples were taken,
+// and events end with ",<ms>", the time of the sample that triggered them
+
+//
+// node commands, for several controllers on one link, see aatg/node.h
+//
+// #3/S1:80 		any command prefixed with "#<id>/" is only run by node <id>, "#255/" reaches every node
+// N1:<id> 		stores the node id, 0 for unaddressed, answered with "N1:<id>,<slots>"
+// N2:<n> 			stores the number of telemetry slots per report period, answered the same way
+// N0:0 			answered with "N1:<id>,<slots>"
+// a node with an id prefixes everything it sends with "#<id>/" and only transmits in slot id % slots,
+// counted from the last heartbeat, so the host should heartbeat every node at the same time, e.g. with "#255/H "
+// a slot is at least a report and two reply lines long, so with several nodes each reports less often than every REPORT_MS
+
+//
+// config commands, settings kept in EEPROM, see struct Config below and aatg/config.h
+//
+// G0:0 			number of settings, answered with "G0:<count>"
+// G1:<index> 		answered with "G1:<index>,<name>,<value>"
+// G2:<index>,<value> 	changes and stores a setting, answered like G1, takes effect at once
+// 					values outside a setting's range, or a missing value, are refused, the reply then holds the value kept
+// 					G1 and G2 with an index past the last setting are answered with "G0:<count>"
+// 					refusals are counted as parse errors
+// 					HBT only applies while no host has negotiated a heartbeat with H1
+// G3:0 			restores the defaults
+
+//
+// flight recorder commands, see aatg/recorder.h
+//
+// D0:0 			recorder state, answered with "D0:<blocks>,<head block>,<head sequence number>,<records>,<dropped>,<logged bytes>,<written bytes>"
+// D1:0 			clears the log
+// D2:<chunk> 		downloads the log from chunk on, answered with "D2:<chunks>,<bytes per chunk>,<first chunk>" and then
+// 					"D5:<chunk>,<hex data>,<crc>" lines, D2:0 starts over from a fresh snapshot of the log
+// 					the snapshot's blocks are not logged to while the download runs, if they were since,
+// 					a resume starts over from a fresh snapshot and first chunk is 0
+// D3:<chunk> 		acknowledges every chunk below chunk, "D3:<chunks>" is sent once the host has all of them
+// D4:0 			stops the download
+// the download runs alongside telemetry and resends unacknowledged chunks, see aatg/transfer.h
+// the recorder logs the channels in recordChannels every config.recordMs ms, linked or not
+
+//
+// memory commands, see aatg/memory.h
+//
+// M1:0 			RAM use, answered with "M1:<free now>,<most stack used>,<never used>,<heap>,<static variables>" in bytes
+
+//
+// flight display, built with -DFLIGHT_LCD, see aatg/lcdqueue.h
+//
+// a 20x4 page with temperatures, distance, battery voltage, servo setpoints and link state
+// T1  123C  T2  118C
+// D1  512  BAT 7.45V
+// S1  80  S2 100  Q 0
+// LINK OK      #3
+// the display is fed from the clock interrupt a byte per millisecond, and the main loop only
+// formats one row per STATUS_MS, so the page never holds up servo or telemetry work
+// lcd.h defaults to PORTC, whose low pins are the ADC inputs here, so the build must define
+// LCDPORT, LCDPIN, LCDDDR and the pins RS, RW, EN, BL, BF and D4-D7 for the display's wiring
+// the pins must avoid C0-C3, B1, B2, D0, D1 and D5-D7, and DDRB and PORTD are written whole below
+
 // buffer used for bluetooth input
 char inputBuffer[256];
 // index indicating next available spot in inputBuffer
 int bufferIndex = 0;
-// keeps track of if the connection is lost
-int inactiveLoops = 0;
+//
+// settings kept in EEPROM, append new fields at the end and bump CONFIG_VERSION
+//
+typedef struct Config {
+	unsigned int pwmTop;			// timer1 TOP, sets the servo PWM period
+	unsigned int pwmLow, pwmHigh;	// output compare values for setpoints 0 and 100
+	unsigned int servoLow, servoHigh;	// endpoints the startup position is taken from
+	int lowVoltage;					// P1 reading at or below which the LED turns red
+	unsigned int heartbeatMs;		// heartbeat interval until the host negotiates one
+	unsigned char keepaliveMisses;	// heartbeat intervals without a frame before the link counts as lost
+	int probeOffset[Ts];			// thermometer trims, added to T1 and T2
+	unsigned int recordMs;			// flight recorder period, 0 turns it off
+} Config;
+
+const Config configDefaults PROGMEM = {40000, 0, 40000, 758, 2478, 664, HEARTBEAT_MS, KEEPALIVE_MISSES, {0, -5}, RECORD_MS};
+const ConfigField configFields[] PROGMEM = {
+	// name	offset								type				min					max
+	{"PWT",	offsetof(Config, pwmTop),			CFG_UINT,			1,					65535},
+	{"PWL",	offsetof(Config, pwmLow),			CFG_UINT,			0,					65535},
+	{"PWH",	offsetof(Config, pwmHigh),			CFG_UINT,			0,					65535},
+	{"SVL",	offsetof(Config, servoLow),			CFG_UINT,			0,					65535},
+	{"SVH",	offsetof(Config, servoHigh),		CFG_UINT,			0,					65535},
+	{"LOV",	offsetof(Config, lowVoltage),		CFG_INT,			0,					1023},
+	{"HBT",	offsetof(Config, heartbeatMs),		CFG_UINT,			HEARTBEAT_MIN_MS,	HEARTBEAT_MAX_MS},
+	{"KAM",	offsetof(Config, keepaliveMisses),	CFG_BYTE,			1,					255},
+	{"OT1",	offsetof(Config, probeOffset[0]),	CFG_INT,			-1023,				1023},
+	{"OT2",	offsetof(Config, probeOffset[1]),	CFG_INT,			-1023,				1023},
+	{"RCP",	offsetof(Config, recordMs),			CFG_UINT|CFG_ZERO,	RECORD_MIN_MS,		65535},
+};
+Config config;
+
+// keeps track of if the connection is lost, time of the last valid frame
+volatile unsigned long lastHeard = 0;
+unsigned int heartbeatMs = HEARTBEAT_MS;
+volatile unsigned char heartbeatNegotiated = 0;	// set by H1, config.heartbeatMs no longer applies until the link is lost
+volatile unsigned char heartbeatPending = 0;
 // Counter which increments on loop run through
 int mainLoops = 0;
+// channel sampling, done in the clock interrupt every SAMPLE_MS ticks
+volatile unsigned long lastSample = 0;
+unsigned char sampleCountdown = SAMPLE_MS;
 // temperature storage
 int T[Ts];
-int S[Ss];
+int S[Ss] = {SERVO_NONE, SERVO_NONE, SERVO_NONE};
 int P = 0;
+// script upload waiting to be written to EEPROM by the main loop
+volatile unsigned char uploadPending = 0;
+unsigned char uploadSlot, uploadOffset, uploadLength;
+unsigned char uploadData[UPLOAD_MAX];
+// link statistics
+unsigned long rxBytes = 0;		// bytes received
+unsigned int rxFrames = 0;		// commands parsed
+unsigned int rxErrors = 0;		// malformed or unknown commands
+unsigned int rxOverruns = 0;	// bytes lost to USART overruns or commands too long for inputBuffer
+unsigned int echoSeq = 0;		// echo replies sent
+// pending replies
+volatile unsigned char echoPending = 0;
+unsigned long echoReceived;		// device clock when the pending echo arrived
+volatile unsigned char statsPending = 0;
+char echoBuffer[ECHO_MAX];
+// channel query, -1 for none, -2 for the channel count
+volatile signed char channelQuery = -1;
+// trigger rule waiting to be applied by the main loop
+volatile unsigned char rulePending = 0;
+unsigned char ruleChannel;
+ChannelRule ruleNew;
+// node setting waiting to be stored by the main loop, -1 for none
+volatile signed char nodePending = -1;
+unsigned char nodeValue;
+// config command waiting for the main loop, -1 for none
+volatile signed char configPending = -1;
+// recorder command waiting for the main loop, -1 for none
+volatile signed char recorderPending = -1;
+int recorderValue;
+volatile int transferAck = -1;	// latest download acknowledgement, -1 for none
+volatile unsigned char memoryPending = 0;
+unsigned char configIndex;
+long configValue;
+
+char linkAlive() {
+	unsigned long heard, window;
+	unsigned char sreg;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	heard = lastHeard;
+	window = (unsigned long)heartbeatMs*config.keepaliveMisses;
+	SREG = sreg; // restore global interrupt flag state
+	if(heard == 0) // nothing received since boot
+		return 0;
+	return clock_millis() - heard < window;
+}
+
+// applies a servo setpoint, called from the command queue on the millisecond it is due
+void setServo(unsigned char i, int val) {
+	if(i >= Ss)
+		return;
+	S[i] = val;
+	if(!linkAlive() || val < 0 || val > 100)
+		return;
+	if(i == 1)
+		timer1_set_output_compare_registerA(linInterp(val,config.pwmLow,config.pwmHigh));
+	else if(i == 2)
+		timer1_set_output_compare_registerB(linInterp(val,config.pwmLow,config.pwmHigh));
+}
+
+int readChannel(unsigned char channel) {return channels_value(channel);}
+
+int queueLength() {return cmdqueue_length();}
+int queueNextIn() {
+	long next = cmdqueue_next_in(clock_millis());
+	return next > 32767 ? 32767 : next;
+}
+
+//
+// telemetry channels, in the order they are reported
+// indices are the sensor channels used by scripts, so append new channels at the end
+// at most CHANNELS_MAX (8) of them, raise it with a define before aatg/channels.h is included
+// thermometer conversion, kept on the host for now: (raw-624)*114/100
+//
+const Channel channelTable[] PROGMEM = {
+	// name	source			pin	var		func			mul	div	offset	filter	rate
+	{"T1",	CH_SRC_ADC,		0,	0,		0,				1,	1,	0,		0,		1},
+	{"T2",	CH_SRC_ADC,		1,	0,		0,				1,	1,	0,		0,		1},
+	{"D1",	CH_SRC_ADC,		2,	0,		0,				1,	1,	0,		0,		1},
+	{"P1",	CH_SRC_ADC,		3,	0,		0,				1,	1,	0,		0,		1},
+	{"S1",	CH_SRC_VAR,		0,	&S[1],	0,				1,	1,	0,		0,		1},
+	{"S2",	CH_SRC_VAR,		0,	&S[2],	0,				1,	1,	0,		0,		1},
+	{"Q1",	CH_SRC_DERIVED,	0,	0,		queueLength,	1,	1,	0,		0,		1},
+	{"Q2",	CH_SRC_DERIVED,	0,	0,		queueNextIn,	1,	1,	0,		0,		1},
+};
+#define CH_T1 0
+#define CH_T2 1
+#define CH_D1 2
+#define CH_P1 3
+
+// channels kept by the flight recorder: T1, T2, D1, P1, S1 and S2
+const unsigned char recordChannels[] = {0, 1, 2, 3, 4, 5};
+#define RECORD_N sizeof(recordChannels)
+
+// applies settings that live outside the config struct, config_set has already checked their ranges
+void applyConfig() {
+	unsigned char sreg;
+	sreg = SREG; //Save global interrupt flag
+	SREG &= ~(1<<7); // disable global interrupt flag
+	if(!heartbeatNegotiated) // the interval the host asked for stands while the link lasts
+		heartbeatMs = config.heartbeatMs;
+	SREG = sreg; // restore global interrupt flag state
+	timer1_set_input_capture(config.pwmTop);
+	channels_set_trim(CH_T1, config.probeOffset[0]);
+	channels_set_trim(CH_T2, config.probeOffset[1]);
+}
+
+#ifdef FLIGHT_LCD
+// draws one row of the flight display into the shadow buffer
+void statusRow(unsigned char row) {
+	char line[LCDBUF_COLS + 1];
+	unsigned char x;
+	unsigned long heard, mv;
+	int p;
+	switch(row) {
+		case 0: // same conversion as the host, (raw-624)*114/100
+			snprintf(line, sizeof(line), "T1 %4ldC  T2 %4ldC", (long)(channels_value(CH_T1) - 624)*114/100,
+				(long)(channels_value(CH_T2) - 624)*114/100);
+			break;
+		case 1:
+			p = channels_value(CH_P1);
+			mv = p < 0 ? 0 : (unsigned long)p*BATTERY_MV_TOP/1023;
+			snprintf(line, sizeof(line), "D1 %4d  BAT %lu.%02lu%c", channels_value(CH_D1), mv/1000, mv%1000/10,
+				p <= config.lowVoltage ? '!' : 'V');
+			break;
+		case 2:
+			snprintf(line, sizeof(line), "S1 %3d  S2 %3d  Q%2d", S[1], S[2], cmdqueue_length());
+			break;
+		default:
+			disable_global_interrupts(); // 32 bit value is written from the receive interrupt
+			heard = lastHeard;
+			enable_global_interrupts();
+			if(linkAlive())
+				snprintf(line, sizeof(line), "LINK OK      #%d", node_id());
+			else if(heard)
+				snprintf(line, sizeof(line), "LINK LOST %5lus", (clock_millis() - heard)/1000);
+			else
+				snprintf(line, sizeof(line), "NO LINK");
+			break;
+	}
+	// pad with spaces after the text, what follows its terminator was never written
+	for(x = 0; x < LCDBUF_COLS && line[x]; x++)
+		lcdbuf_set(x, row, line[x]);
+	for(; x < LCDBUF_COLS; x++)
+		lcdbuf_set(x, row, ' ');
+}
+#endif
+
+// decodes a single hex digit, returns -1 if c is not one
+int hexDigit(char c) {
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
 
-//int readTemp(int pin) {return (adc_read(pin)-624)*114/100;}
-int readTemp(int pin) {return (adc_read(pin));}
+void onTick() {
+	unsigned long now = clock_millis();
+	cmdqueue_run(now);
+	if(--sampleCountdown == 0) {
+		sampleCountdown = SAMPLE_MS;
+		lastSample = now;
+		channels_sample(now); // about 100 us with the ADC at 1 MHz
+	}
+#ifdef FLIGHT_LCD
+	lcdqueue_tick();
+#endif
+}
 
 void catchRX() {
-	inactiveLoops = INACTIVE_LOOPS;
 	char c;
+	if(UCSR0A & (1<<DOR0))
+		rxOverruns++;
 	c = getchar();
+	rxBytes++;
+	node_heard(clock_millis());
+	if(c == '\n') { // end of a line sent by another node sharing the link
+		bufferIndex = 0;
+		return;
+	}
 	if(c == ' ') { // end of command
-		if(bufferIndex < 2) {
-			bufferIndex = 0;
+		char* frame = inputBuffer;
+		inputBuffer[bufferIndex] = '\0';
+		bufferIndex = 0;
+		if(!node_address(&frame)) // for another node
+			return;
+		if(frame[0] == 'H' && frame[1] == '\0') { // heartbeat
+			lastHeard = clock_millis();
+			node_sync(lastHeard);
+			rxFrames++;
+			return;
+		}
+		if(strlen(frame) < 2) {
+			if(frame[0])
+				rxErrors++;
 			return;
 		}
-		inputBuffer[bufferIndex] = '\0';
 
 		// parse input buffer
-		// get function and index
-		int i = inputBuffer[1]-48; // ascii single digit charecter to int conversion
-		char f = inputBuffer[0];
+		// get function and index, every command is <function><index>:<fields>
+		int i = frame[1]-48; // ascii single digit charecter to int conversion
+		char f = frame[0];
 		int val;
+		int n;
+		char* at;
+		char* duration;
+		unsigned long due;
+		char* data;
+		if(frame[2] != ':' || i < 0 || i > 9) {
+			rxErrors++;
+			return;
+		}
+		// fields are checked here, so the main loop only ever gets commands it can carry out
+		n = sscanf(frame+3, "%d", &val);
+		rxFrames++;
+		lastHeard = clock_millis();
 		switch(f) {
 			case 'S':
-				sscanf(inputBuffer+3, "%d", &val);
-				if(i >= 0 && i < Ss)
-					S[i] = val;
+				if(n != 1 || i >= Ss) {
+					rxErrors++;
+					break;
+				}
+				at = strchr(frame, '@');
+				duration = strchr(frame, '+');
+				// a timed command needs all of its entries queued, or none of it is run
+				if(CMDQUEUE_SIZE - cmdqueue_length() < (at != 0) + (duration != 0)) {
+					rxErrors++;
+					break;
+				}
+				due = clock_millis();
+				if(at)
+					due += atol(at+1);
+				if(duration)
+					cmdqueue_push(due + atol(duration+1), i, S[i]); // restore current setpoint
+				if(at)
+					cmdqueue_push(due, i, val);
+				else
+					setServo(i, val);
+				break;
+			case 'W':
+				// writing EEPROM takes milliseconds per byte, so leave it to the main loop
+				if(uploadPending)
+					break;
+				data = strchr(frame, ',');
+				if(!data || n != 1 || i >= SCRIPT_SLOTS || val < 0 || val >= SCRIPT_SLOT_SIZE) {
+					rxErrors++;
+					break;
+				}
+				uploadSlot = i;
+				uploadOffset = val;
+				uploadLength = 0;
+				for(data++; uploadLength < UPLOAD_MAX && hexDigit(data[0]) >= 0 && hexDigit(data[1]) >= 0; data += 2)
+					uploadData[uploadLength++] = hexDigit(data[0])<<4 | hexDigit(data[1]);
+				uploadPending = 1;
+				break;
+			case 'X':
+				if(n != 1 || val < 0 || val > 3) {
+					rxErrors++;
+					break;
+				}
+				switch(val) {
+					case 0: script_abort(); break;
+					case 1: script_start(i); break;
+					case 2: script_pause(clock_millis()); break;
+					case 3: script_resume(clock_millis()); break;
+				}
+				break;
+			case 'E':
+				if(echoPending)
+					break;
+				strncpy(echoBuffer, frame+3, ECHO_MAX-1);
+				echoBuffer[ECHO_MAX-1] = '\0';
+				echoReceived = clock_millis();
+				echoPending = 1;
+				break;
+			case 'L':
+				statsPending = 1;
+				break;
+			case 'C':
+				if(i == 0) {
+					channelQuery = -2;
+				} else if(n != 1 || val < 0 || val >= channels_count()) {
+					rxErrors++;
+				} else {
+					channelQuery = val;
+				}
+				break;
+			case 'R':
+				// rules are evaluated by the main loop, so hand it over there
+				if(rulePending)
+					break;
+				ruleNew.type = i;
+				ruleNew.level = ruleNew.hysteresis = 0;
+				if(sscanf(frame+3, "%d,%d,%d", &val, &ruleNew.level, &ruleNew.hysteresis) < 1 || val < 0 || val >= channels_count()) {
+					rxErrors++;
+					break;
+				}
+				ruleChannel = val;
+				rulePending = 1;
+				break;
+			case 'K':
+				if(n != 1 || val < 0 || val > 255) {
+					rxErrors++;
+					break;
+				}
+				channels_set_keyframe_interval(val);
+				break;
+			case 'G':
+				// storing takes milliseconds, so leave it to the main loop
+				if(configPending != -1)
+					break;
+				if(i > 3 || n != 1) {
+					rxErrors++;
+					break;
+				}
+				if((i == 1 || i == 2) && (val < 0 || val >= config_count())) {
+					rxErrors++;
+					configPending = 0; // the count shows the host which indices exist
+					break;
+				}
+				configIndex = val;
+				if(i == 2 && sscanf(frame+3, "%d,%ld", &val, &configValue) != 2) {
+					rxErrors++;
+					configPending = 1; // nothing is stored, the reply holds the value kept
+					break;
+				}
+				configPending = i;
+				break;
+			case 'D':
+				if(n != 1 || i > 4) {
+					rxErrors++;
+					break;
+				}
+				if(i == 3) { // acknowledgements come often, only the latest matters
+					transferAck = val;
+					break;
+				}
+				if(recorderPending != -1)
+					break;
+				recorderValue = val;
+				recorderPending = i;
+				break;
+			case 'M':
+				memoryPending = 1;
+				break;
+			case 'N':
+				// storing takes milliseconds, so leave it to the main loop
+				if(nodePending != -1)
+					break;
+				if(n != 1 || i > 2 || val < 0 || val > 255) {
+					rxErrors++;
+					break;
+				}
+				nodeValue = val;
+				nodePending = i;
+				break;
+			case 'H':
+				if(n != 1) {
+					rxErrors++;
+					break;
+				}
+				heartbeatMs = val < HEARTBEAT_MIN_MS ? HEARTBEAT_MIN_MS : (val > HEARTBEAT_MAX_MS ? HEARTBEAT_MAX_MS : val);
+				heartbeatNegotiated = 1;
+				heartbeatPending = 1;
+				break;
+			default:
+				rxErrors++;
 				break;
 		}
-	
-		bufferIndex = 0;
 	}
 	else {
 		inputBuffer[bufferIndex] = c;
 		bufferIndex++;
+		if(bufferIndex >= 256)
+			rxOverruns++;
 		bufferIndex %= 256;
 	}
 }
@@ -104,6 +616,13 @@ int main() {
 	usart_init();
 	adc_enable();
 	adc_set_ref(ADC_REF_2_56V);
+	clock_init();
+	clock_set_tick_function(onTick);
+	cmdqueue_set_function(setServo);
+	script_set_output_function(setServo);
+	script_set_input_function(readChannel);
+	channels_init(channelTable, sizeof(channelTable)/sizeof(Channel));
+	node_init(REPORT_MS, REPORT_AIR_MS + 2*NODE_LINE_MS); // room for a report and a couple of replies
 
 	usart_set_recieve_interrupt_function(catchRX);
 	usart_recieve_interrupt_enable();
@@ -112,9 +631,12 @@ int main() {
 	timer0_set_overflow_interrupt_function(blink);
 	timer0_overflow_interrupt_enable();
 	*/
+	// settings are loaded and checked before any output is driven
+	config_init(&config, &configDefaults, sizeof(Config), CONFIG_VERSION, configFields, sizeof(configFields)/sizeof(ConfigField));
+	recorder_init(&recorder_eeprom);
 	timer1_init(PWM_FAST_INPUT_CAPTURE, PWM_FAST16_NON_INVERT, PWM_FAST16_NON_INVERT, CLOCK_PRESCALER_1);
-	timer1_set_input_capture(40000);
-	timer1_set_output_compare_registerA(linInterp(50,758,2478));
+	applyConfig();
+	timer1_set_output_compare_registerA(linInterp(50,config.servoLow,config.servoHigh));
 	/*	
 	timer2_init(PWM_PHASE_CORRECT, PWM_PHASE_NORMAL, CLOCK2_PRESCALER_1024);
 	timer2_overflow_interrupt_enable();
@@ -124,37 +646,192 @@ int main() {
 
 	DDRB = 0b00111111;
 	DDRD = 7<<5; // rgb
+#ifdef FLIGHT_LCD
+	lcdqueue_init();	// takes a second to boot the display, without waiting for it
+	lcdbuf_attach(lcdqueue_write);
+#endif
 
+	unsigned long now;
+	unsigned long lastReport = 0;
+	unsigned long sampled;
+	unsigned long lastRecord = 0;
+	int record[RECORD_N];
+	unsigned char r;
+	unsigned char reportPending = 0;
+#ifdef FLIGHT_LCD
+	unsigned long lastStatus = 0;
+	unsigned char statusNext = 0;
+#endif
 	while(1 == 1) {
-		mainLoops++;
-		P = adc_read(3);
-		if(inactiveLoops <= 0) {
-			// reset
-			timer1_set_output_compare_registerA(0);
-			timer1_set_output_compare_registerB(0);
-			int rgbcolor = (P <= 664 ? RGBR : RGBB);
-			PORTD = ((mainLoops%2)<<rgbcolor)&(7<<rgbcolor);
-		}
-		else {
-			inactiveLoops--;
-			PORTD = 1<<(P <= 664 ? RGBR : RGBB);
-
-			// set servo position
-			if(S[1] > -1 && S[1] <= 100 ) {
-				timer1_set_output_compare_registerA(linInterp(S[1],0,40000));
+		now = clock_millis();
+		script_run(now);
+		if(config.recordMs && now - lastRecord >= config.recordMs) {
+			lastRecord = now;
+			for(r = 0; r < RECORD_N; r++)
+				record[r] = channels_value(recordChannels[r]);
+			recorder_log(now, record, RECORD_N);
+		}
+		recorder_run();
+		if(now - lastReport >= REPORT_MS) {
+			lastReport = now;
+			mainLoops++;
+			P = channels_value(CH_P1);
+			if(!linkAlive()) {
+				// reset
+				cmdqueue_clear();
+				script_abort();
+				for(r = 0; r < Ss; r++)
+					S[r] = SERVO_NONE; // the host has to send them again
+				// the next host negotiates its own heartbeat, until then the configured one applies
+				disable_global_interrupts();
+				if(!linkAlive()) {
+					heartbeatNegotiated = 0;
+					heartbeatMs = config.heartbeatMs;
+				}
+				enable_global_interrupts();
+				timer1_set_output_compare_registerA(0);
+				timer1_set_output_compare_registerB(0);
+				int rgbcolor = (P <= config.lowVoltage ? RGBR : RGBB);
+				PORTD = ((mainLoops%2)<<rgbcolor)&(7<<rgbcolor);
+				reportPending = 0;
+			}
+			else {
+				PORTD = 1<<(P <= config.lowVoltage ? RGBR : RGBB);
+
+				// set servo position
+				if(S[1] > -1 && S[1] <= 100 ) {
+					timer1_set_output_compare_registerA(linInterp(S[1],config.pwmLow,config.pwmHigh));
+				}
+				if(S[2] > -1 && S[2] <= 100 ) {
+					timer1_set_output_compare_registerB(linInterp(S[2],config.pwmLow,config.pwmHigh));
+				}
+				reportPending = 1;
+			}
+		}
+
+		if(transferAck != -1) {
+			int ack;
+			disable_global_interrupts(); // 16 bit value is written from the receive interrupt
+			ack = transferAck;
+			transferAck = -1;
+			enable_global_interrupts();
+			transfer_ack(ack, now);
+		}
+
+#ifdef FLIGHT_LCD
+		// flight display, lowest priority. One row is formatted per slice and the flush only
+		// queues the changed cells the queue has room for, whatever is left goes with the next row
+		if(now - lastStatus >= STATUS_MS) {
+			lastStatus = now;
+			statusRow(statusNext);
+			statusNext = (statusNext + 1) % LCDBUF_ROWS;
+			lcdbuf_flush();
+		}
+#endif
+
+		// everything below transmits, so wait for the line to be quiet. With several nodes each
+		// reply, event and report is only started if it fits in what is left of this node's slot
+		if(!node_clear_to_send(now))
+			continue;
+		if(nodePending != -1 && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			if(nodePending == 1)
+				node_set_id(nodeValue);
+			else if(nodePending == 2)
+				node_set_slots(nodeValue);
+			printf("N1:%d,%d\n", node_id(), node_slots());
+			nodePending = -1;
+		}
+		if(memoryPending && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			memory_describe();
+			memoryPending = 0;
+		}
+		if(recorderPending != -1 && node_can_send(clock_millis(), 2*NODE_LINE_MS)) {
+			switch(recorderPending) {
+				case 1:
+					transfer_stop();
+					recorder_clear();
+					recorder_describe();
+					break;
+				case 2:
+					if(recorderValue == 0 || !recorder_snapshot_size()) {
+						recorder_snapshot();
+						recorderValue = 0; // a new snapshot, the host starts over
+					}
+					transfer_start(recorder_snapshot_read, recorder_snapshot_size(), recorderValue, now);
+					printf("D2:%u,%d,%d\n", transfer_chunks(), TRANSFER_CHUNK, recorderValue);
+					break;
+				case 4:
+					transfer_stop();
+					// fall through to the state
+				default:
+					recorder_describe();
+					break;
 			}
-			if(S[2] > -1 && S[2] <= 100 ) {
-				timer1_set_output_compare_registerB(linInterp(S[2],0,40000));
+			recorderPending = -1;
+		}
+		if(configPending != -1 && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			switch(configPending) {
+				case 0: printf("G0:%d\n", config_count()); break;
+				case 2: // answered with the value kept, so a refused value shows
+					if(config_set(configIndex, configValue))
+						applyConfig();
+					else
+						rxErrors++;
+					// fall through to the reply
+				case 1: config_describe(configIndex); break;
+				case 3: config_defaults(); applyConfig(); printf("G0:%d\n", config_count()); break;
 			}
-			// send thermo value
-			printf("S1:%d\n", S[1]);
-			printf("S2:%d\n", S[2]);
-			printf("T1:%d\n", readTemp(0));
-			printf("T2:%d\n", readTemp(1));
-			printf("D1:%d\n", adc_read(2));
-			printf("P1:%d\n", P);
-		}
-		_delay_ms(250);
+			configPending = -1;
+		}
+		if(uploadPending && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			script_write(uploadSlot, uploadOffset, uploadData, uploadLength);
+			printf("W%d:%d,%d\n", uploadSlot, uploadOffset, uploadLength);
+			uploadPending = 0;
+		}
+		if(echoPending && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			printf("E1:%s,%u,%lu,%lu\n", echoBuffer, ++echoSeq, echoReceived, clock_millis());
+			echoPending = 0;
+		}
+		if(heartbeatPending && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			printf("H1:%u\n", heartbeatMs);
+			heartbeatPending = 0;
+		}
+		if(statsPending && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			unsigned long bytes;
+			disable_global_interrupts(); // 32 bit counter is updated from the receive interrupt
+			bytes = rxBytes;
+			enable_global_interrupts();
+			printf("L1:%lu,%u,%u,%u,%u\n", bytes, rxFrames, rxErrors, rxOverruns, echoSeq);
+			statsPending = 0;
+		}
+		if(rulePending) {
+			if(!channels_set_rule(ruleChannel, ruleNew.type, ruleNew.level, ruleNew.hysteresis))
+				rxErrors++;
+			rulePending = 0;
+		}
+		if(channelQuery != -1 && node_can_send(clock_millis(), NODE_LINE_MS)) {
+			if(channelQuery == -2)
+				printf("C0:%d\n", channels_count());
+			else
+				channels_describe(channelQuery);
+			channelQuery = -1;
+		}
+		while(node_can_send(clock_millis(), NODE_LINE_MS) && channels_report_events());
+		if(node_can_send(clock_millis(), NODE_LINE_MS))
+			transfer_run(now);
+		if(!transfer_active())
+			recorder_release(); // the log may overwrite the snapshot, a resume finds out
+		if(reportPending && node_can_send(clock_millis(), REPORT_AIR_MS)) {
+			// send channel values
+			disable_global_interrupts(); // 32 bit value is written from the clock interrupt
+			sampled = lastSample;
+			enable_global_interrupts();
+			printf("Z1:%lu\n", sampled);
+			channels_report(mainLoops);
+			// script interpreter state
+			printf("X%d:%d\n", script_slot(), script_state());
+			reportPending = 0;
+		}
 	}
 	return 0;
 }
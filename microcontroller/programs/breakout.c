@@ -17,18 +17,15 @@
 #include <stdlib.h>
 
 #include "../aatg/buttons.h"
-#include "../aatg/lcd.h"
+#include "../aatg/canvas.h"
 
-#define SCREEN_WIDTH  32
-#define SCREEN_HEIGHT 100
-#define CHARH 5
-#define CHARW 8
+#define SCREEN_WIDTH  CANVAS_WIDTH
+#define SCREEN_HEIGHT CANVAS_HEIGHT
+#define CHARH CANVAS_CHARH
+#define CHARW CANVAS_CHARW
 #define YCHARS 20
 #define XCHARS 4 
 
-#define BRICK 0xFF
-#define TRANSPARENT 0xFE
-
 void Breakout(); // Run this function to start the program
 
 typedef struct object {
@@ -36,36 +33,10 @@ typedef struct object {
 	bool visible;
 } object;
 
-int Draw(object* obj, int start) {
-	// make empty array of tiles
-	unsigned char screen[20][4][8];
-	int a,b,c;
-	for(a = 0; a < 20; a++)
-		for(b = 0; b < 4; b++)
-			for(c = 0; c < 8; c++)
-				screen[a][b][c] = 0;
-
-	//calculate pixels to be drawn
-	int y,x;
-	for(y = 0; y < obj->h; y++) {
-		for(x = 0; x < obj->w; x++) {
-			screen[(obj->y + y)/CHARH][(obj->x + x)/CHARW][(obj->x + x)%CHARW] |= (1<<((SCREEN_HEIGHT-1-(obj->y + y))%CHARH));
-		}
-	}
-
-	// generate sprites and draw
-	int spriteNum = start;
-	for(y = obj->y-(obj->y%CHARH); y < obj->y+obj->h; y+= CHARH) {
-		for(x = obj->x-(obj->x%CHARW); x < obj->x+obj->w; x+= CHARW) {
-			if(spriteNum < 7) {
-				lcd_set_char(spriteNum,(unsigned char*)screen[y/CHARH][x/CHARW]);
-				lcd_gotoxy(y/CHARH, x/CHARW);
-				_lcd_write_byte(spriteNum++,1);
-			}
-		}
-	}
-	return spriteNum;
-		
+// composites obj onto the canvas
+void Draw(object* obj) {
+	if(obj->visible)
+		canvas_fill(obj->x, obj->y, obj->w, obj->h, true);
 }
 
 void Breakout() {
@@ -75,55 +46,32 @@ void Breakout() {
 	DDRB = 0xFF;
 	PORTB = points;
 
+	lcdbuf_init();
+	canvas_init();
+
 	object bricks[4][3];
 	for(i = 0; i < 4; i++) {
 		for(j = 0; j < 3; j++) {
-			bricks[i][j].x = i;
-			bricks[i][j].y = j+YCHARS-3;
+			bricks[i][j].x = i*CHARW;
+			bricks[i][j].y = (YCHARS-1-j)*CHARH; // the row the ball checks below
 			bricks[i][j].w = CHARW;
 			bricks[i][j].h = CHARH;
 			bricks[i][j].visible = true;
 		}
 	}
-	// Draw bricks
-	for(i = 0; i < 4; i++) {
-		for(j = 0; j < 3; j++) {
-			lcd_gotoxy(bricks[i][j].y,bricks[i][j].x);
-			_lcd_write_byte(BRICK,1);
-		}
-	}
 	
 	object player = {12,9,7,1,1};
 	object ball   = {15,10,1,1,1};
 	int ballDX, ballDY;
 	ballDY = 1;
 	ballDX = 1;
-	bool hit = true;
-	bool changed = true;
-	int oldXSquare = ball.x/CHARW, oldYSquare = ball.y/CHARH;
 	while(1) {
 		// if left pressed
-		if(is_pressed(3) && player.x > 0) {
-			// if player pad leaving a screen character
-			if((player.x+player.w)%CHARW == 1) {
-				//overwrite with blank
-				lcd_gotoxy((player.y+player.h-1)/CHARH, (player.x+player.w)/CHARW);
-				_lcd_write_byte(TRANSPARENT,1);
-			}
-			changed = true;
+		if(is_pressed(3) && player.x > 0)
 			player.x--;
-		}
 		//if right pressed
-		if(is_pressed(4) && player.x + player.w < SCREEN_WIDTH) {
-			// if player pad leaving a screen character
-			if(player.x%CHARW == CHARW-1) {
-				//overwrite with blank
-				lcd_gotoxy(player.y/CHARH, player.x/CHARW);
-				_lcd_write_byte(TRANSPARENT,1);
-			}
-			changed = true;
+		if(is_pressed(4) && player.x + player.w < SCREEN_WIDTH)
 			player.x++;
-		}
 
 		
 		ball.y += ballDY;
@@ -138,8 +86,6 @@ void Breakout() {
 			if(ball.y/CHARH > YCHARS-4  ) {
 				if(bricks[ball.x/CHARW][YCHARS-(ball.y/CHARH)-1].visible == true) {
 					bricks[ball.x/CHARW][YCHARS-(ball.y/CHARH)-1].visible = false;
-					lcd_gotoxy(ball.y/CHARH, ball.x/CHARW);
-					_lcd_write_byte(TRANSPARENT,1);
 					ballDY *= -1;
 					ball.y += ballDY;
 					points++;
@@ -151,8 +97,6 @@ void Breakout() {
 			if(ball.y/CHARH > YCHARS-4  ) {
 				if(bricks[ball.x/CHARW][YCHARS-(ball.y/CHARH)-1].visible == true) {
 					bricks[ball.x/CHARW][YCHARS-(ball.y/CHARH)-1].visible = false;
-					lcd_gotoxy(ball.y/CHARH, ball.x/CHARW);
-					_lcd_write_byte(TRANSPARENT,1);
 					ballDX *= -1;
 					ball.x += ballDX;
 					points++;
@@ -166,41 +110,32 @@ void Breakout() {
 		if(ball.x == 0 || ball.x == SCREEN_WIDTH-1)
 			ballDX *= -1;
 
-		if(changed) {
-			Draw(&player, 1);
-		}
-		
-
-		//DRAW BALL
-		if(ball.x/CHARW != oldXSquare || ball.y/CHARH != oldYSquare) {
-			//Clear ball position //TODO: if leaving CG square
-			lcd_gotoxy(oldYSquare,oldXSquare);
-			_lcd_write_byte(TRANSPARENT,1);
-			oldXSquare = ball.x/CHARW;
-			oldYSquare = ball.y/CHARH;
-		}
-		
-		if(player.y/CHARH == oldYSquare && player.x/CHARW == oldXSquare)
-			;//Draw(&ball, 1);
-		else if(player.y/CHARH == oldYSquare && (player.x+player.w)/CHARW == oldXSquare)
-			;//Draw(&ball, 2);
-		else
-			Draw(&ball, 0);
+		// draw the frame, only characters that changed reach the display
+		canvas_clear();
+		for(i = 0; i < 4; i++)
+			for(j = 0; j < 3; j++)
+				Draw(&bricks[i][j]);
+		Draw(&player);
+		Draw(&ball);
+		canvas_render();
+		lcdbuf_flush();
 
 		if(ball.y <= 0) {
 			_delay_ms(1000);
-			lcd_clear();
-			lcd_gotoxy(6,2);
-			lcd_puts("You Lost");
+			lcdbuf_clear();
+			lcdbuf_gotoxy(6,2);
+			lcdbuf_puts("You Lost");
+			lcdbuf_flush();
 			_delay_ms(3000);
 			lcd_clear();
 			break;
 		}
 		else if(points == 12) {
 			_delay_ms(1000);
-			lcd_clear();
-			lcd_gotoxy(6,1);
-			lcd_puts("You Won!");
+			lcdbuf_clear();
+			lcdbuf_gotoxy(6,1);
+			lcdbuf_puts("You Won!");
+			lcdbuf_flush();
 			_delay_ms(3000);
 			lcd_clear();
 			break;
@@ -208,7 +143,6 @@ void Breakout() {
 
 		//do timeing
 		_delay_ms(100);
-		changed = hit = false;
 	}
 
 }
@@ -0,0 +1,65 @@
+ /**
+  * File:    lcdbench.c
+  *
+  * Description:
+  * 	Benchmark of the LCD driver's two timing modes.
+  * 	Redraws the full 20x4 screen BENCH_REDRAWS times with the fixed worst case delays and
+  * 	again while polling the busy flag, and prints over the serial port for each mode:
+  * 		mode, average microseconds per full redraw, characters per second
+  * 	If the busy flag mode fell back to the delays, because the display never answered, that is printed too.
+  * 	Time is measured with timer1 counting every 64 CPU clocks, 4 us at 16 MHz.
+  *
+  * Usage:
+  * 	make SRC=programs/lcdbench and watch the serial port at 9600 baud.
+  * 	The busy flag mode needs RW wired to the display.
+  */
+
+#include <avr/io.h>
+#include <stdlib.h>
+
+#include "../aatg/essentials.h"
+#include "../aatg/serial.h"
+#include "../aatg/timers.h"
+#include "../aatg/lcd.h"
+
+#define BENCH_REDRAWS 20
+#define BENCH_CHARS (20*4)
+#define BENCH_US_PER_TICK 4
+
+// full redraw, row by row like a status page
+unsigned int redraw(char fill) {
+	unsigned char x, y;
+	unsigned int start = timer1_get_counter();
+	for(y = 0; y < 4; y++) {
+		lcd_gotoxy(0, y);
+		for(x = 0; x < 20; x++)
+			lcd_put(fill + (x + y) % 10);
+	}
+	return timer1_get_counter() - start;
+}
+
+void bench(char* mode, char fill) {
+	unsigned long total = 0;
+	unsigned char i;
+	for(i = 0; i < BENCH_REDRAWS; i++)
+		total += redraw(fill + (i & 1) * 10); // alternate so every redraw changes the screen
+	total = total * BENCH_US_PER_TICK / BENCH_REDRAWS;
+	printf("%s: %lu us per redraw, %lu chars/s\n", mode, total, BENCH_CHARS * 1000000UL / total);
+}
+
+int main() {
+	usart_init();
+	timer1_init(NORMAL16_MODE, NON_PWM_NORMAL, NON_PWM_NORMAL, CLOCK_PRESCALER_64);
+	lcd_init();
+	lcd_clear();
+
+	bench("delays", '0');
+
+	lcd_use_busy_flag(true);
+	bench("busy flag", 'A');
+	if(!lcd_busy_flag)
+		printf("busy flag did not answer, fell back to delays\n");
+
+	while(1);
+	return 0;
+}
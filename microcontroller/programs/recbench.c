@@ -0,0 +1,78 @@
+ /**
+  * File:    recbench.c
+  *
+  * Description:
+  * 	Benchmark of the flight recorder's sample compression.
+  * 	Records a synthetic burn profile, the six channels main.c records, into a
+  * 	RAM recorder the size of the EEPROM one and prints over the serial port:
+  * 		records, raw bytes (2 per channel and 2 for the timestamp), compressed bytes,
+  * 		compression ratio, average and worst cycles per recorder_log()
+  * 	Cycles are counted with timer1 running at the CPU clock.
+  *
+  * Usage:
+  * 	make SRC=programs/recbench and watch the serial port at 9600 baud.
+  */
+
+#include <avr/io.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORDER_RAM_SIZE 768
+#include "../aatg/essentials.h"
+#include "../aatg/serial.h"
+#include "../aatg/timers.h"
+#include "../aatg/recorder.h"
+
+#define BENCH_CHANNELS 6
+#define BENCH_PERIOD_MS 1000
+
+// one second of a burn profile, T1 and T2 follow the burner, P1 sags while it burns
+void profile(unsigned int t, int* v) {
+	unsigned char burning = (t % 60) < 8; // 8 s burn every minute
+	static int temperature = 640;
+	if(burning)
+		temperature += 12;
+	else if(temperature > 640)
+		temperature -= 2;
+	v[0] = temperature + rand()%3 - 1;			// T1
+	v[1] = temperature - 15 + rand()%3 - 1;		// T2
+	v[2] = 200 + t/4 + rand()%5 - 2;			// D1, slow climb
+	v[3] = 800 - t/30 - (burning ? 6 : 0);		// P1
+	v[4] = burning ? 80 : 50;					// S1
+	v[5] = 25;									// S2
+}
+
+int main() {
+	int values[BENCH_CHANNELS];
+	unsigned int t, start, cycles, worst = 0;
+	unsigned long total = 0;
+	unsigned int blocks;
+
+	usart_init();
+	timer1_init(NORMAL16_MODE, NON_PWM_NORMAL, NON_PWM_NORMAL, CLOCK_PRESCALER_1);
+	memset(_recorder_ram, 0xFF, RECORDER_RAM_SIZE); // as an erased EEPROM
+	recorder_init(&recorder_ram);
+	blocks = recorder_blocks();
+
+	// until the last block is started, so the log has not wrapped
+	for(t = 0; recorder_seq() < blocks; t++) {
+		profile(t, values);
+		start = timer1_get_counter();
+		recorder_log((unsigned long)t*BENCH_PERIOD_MS, values, BENCH_CHANNELS);
+		cycles = timer1_get_counter() - start;
+		total += cycles;
+		if(cycles > worst)
+			worst = cycles;
+		while(!recorder_idle())
+			recorder_run();
+	}
+
+	printf("records %u\n", _recorder_records);
+	printf("raw bytes %lu\n", (unsigned long)_recorder_records * (2 + 2*BENCH_CHANNELS));
+	printf("compressed bytes %lu\n", _recorder_logged);
+	printf("ratio %lu.%02lu\n", (unsigned long)_recorder_records * (2 + 2*BENCH_CHANNELS) / _recorder_logged,
+		(unsigned long)_recorder_records * (2 + 2*BENCH_CHANNELS) * 100 / _recorder_logged % 100);
+	printf("cycles per sample %lu, worst %u\n", total / _recorder_records, worst);
+	while(1);
+	return 0;
+}
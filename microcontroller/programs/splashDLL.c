@@ -2,6 +2,7 @@
 #define __AFTER_INIT__
 
 #include "../aatg/lcd.h"
+#include "../aatg/glyphcache.h"
 
 void Splash(); // Run this function to start the splash screen
 
@@ -103,14 +104,9 @@ void Splash() {
 	struct animStep anim[16];
 	char name[3];
 
-	lcd_set_char(0,(unsigned char*)Aini0);
-	lcd_set_char(1,(unsigned char*)Aini1);
-	lcd_set_char(2,(unsigned char*)Aini2);
-	lcd_set_char(3,(unsigned char*)Aini3);
-	lcd_set_char(4,(unsigned char*)Aini4);
-	lcd_set_char(5,(unsigned char*)Aini5);
-	lcd_set_char(6,(unsigned char*)Aini6);
-	lcd_set_char(7,(unsigned char*)Aini7);
+	// glyphs are loaded as the animation first needs them, all in one frame as they stay on screen
+	const unsigned char* sprites[8] = {Aini0, Aini1, Aini2, Aini3, Aini4, Aini5, Aini6, Aini7};
+	glyphcache_frame();
 
 	int animLength = 13; 
 	int i;
@@ -135,18 +131,22 @@ void Splash() {
 
 
 	for(i = 0; i < animLength; i++) {
+		unsigned char glyph;
 		if(i == 6) {
+			glyph = glyphcache_get((unsigned char*)sprites[5]);
 			lcd_gotoxy(i+2,2);
-			_lcd_write_byte(5,1);
+			_lcd_write_byte(glyph,1);
 		}
 		else if(i > 6 && i < 10) {
+			glyph = glyphcache_get((unsigned char*)sprites[6]);
 			lcd_gotoxy(i+2,2);
-			_lcd_write_byte(6,1);
+			_lcd_write_byte(glyph,1);
 			lcd_gotoxy(i+2,1);
 			_lcd_write_byte(name[i-7],1);
 		}
+		glyph = glyphcache_get((unsigned char*)sprites[anim[i].sprite]);
 		lcd_gotoxy(anim[i].posx,anim[i].posy);
-		_lcd_write_byte(anim[i].sprite,1);
+		_lcd_write_byte(glyph,1);
 		_delay_ms(100);
 	}
 
@@ -0,0 +1,58 @@
+ /**
+  * File:    stepbench.c
+  *
+  * Description:
+  * 	Benchmark of one step of a stepper motor in each stepping scheme.
+  * 	Steps a motor BENCH_STEPS times each way with 'stepmotor_advance' and prints over the serial port:
+  * 		scheme, average and worst cycles per step
+  * 	Cycles are counted with timer1 running at the CPU clock, and include the call and reading the timer.
+  * 	The motor drives a byte in RAM, so nothing needs to be wired up.
+  * 	A step is a position change and one masked write of the motor's precomputed table entry,
+  * 	so the numbers should be the same for every scheme.
+  *
+  * Usage:
+  * 	make SRC=programs/stepbench and watch the serial port at 9600 baud.
+  */
+
+#include <avr/io.h>
+#include <stdlib.h>
+
+#include "../aatg/essentials.h"
+#include "../aatg/serial.h"
+#include "../aatg/timers.h"
+#include "../aatg/motorControl.h"
+
+#define BENCH_STEPS 400
+
+volatile uint8_t benchPort = 0;
+unsigned char benchPhases[nCoils] = {4, 5, 6, 7};
+
+void bench(char* name, unsigned char scheme) {
+	Stepmotor* motor = stepmotor_init(18, scheme, &benchPort, nCoils, benchPhases);
+	unsigned int i, start, cycles, worst = 0;
+	unsigned long total = 0;
+	char direction = CLOCKWISE;
+	for(i = 0; i < 2*BENCH_STEPS; i++) {
+		if(i == BENCH_STEPS)
+			direction = COUNTERCLOCKWISE;
+		start = timer1_get_counter();
+		stepmotor_advance(motor, direction);
+		cycles = timer1_get_counter() - start;
+		total += cycles;
+		if(cycles > worst)
+			worst = cycles;
+	}
+	printf("%s: %lu cycles per step, worst %u\n", name, total / (2*BENCH_STEPS), worst);
+}
+
+int main() {
+	usart_init();
+	timer1_init(NORMAL16_MODE, NON_PWM_NORMAL, NON_PWM_NORMAL, CLOCK_PRESCALER_1);
+
+	bench("wave drive", WAVE_DRIVE);
+	bench("full step", FULL_STEP);
+	bench("half step", HALF_STEP);
+
+	while(1);
+	return 0;
+}
@@ -0,0 +1,19 @@
+// Assembles test scripts with the app's assembler, www/js/scriptasm.js, into a C header
+//
+//     node assemble.js scripts/*.script > scripts.h
+//
+// every file becomes 'const unsigned char script_<name>[]' and 'script_<name>_size'
+var fs = require('fs');
+var path = require('path');
+var vm = require('vm');
+
+vm.runInThisContext(fs.readFileSync(path.join(__dirname, '../../www/js/scriptasm.js'), 'utf8'));
+
+var out = ['// generated by assemble.js, do not edit'];
+process.argv.slice(2).forEach(function(file) {
+    var name = path.basename(file, '.script');
+    var bytes = scriptasm.assemble(fs.readFileSync(file, 'utf8'));
+    out.push('const unsigned char script_' + name + '[] = {' + bytes.join(', ') + '};');
+    out.push('#define script_' + name + '_size ' + bytes.length);
+});
+console.log(out.join('\n'));
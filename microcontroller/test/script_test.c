@@ -0,0 +1,106 @@
+ /**
+  * File:   script_test.c
+  *
+  * Description:
+  * 	Host test of the script interpreter in aatg/script.h.
+  * 	Runs the scripts in scripts/, assembled by the app's assembler into scripts.h, one
+  * 	millisecond at a time against fake servos and sensors and checks what was set when.
+  *
+  * Usage:
+  * 	make test, prints a line per check and exits with 1 if any failed.
+  */
+
+#include <stdio.h>
+
+#include "../aatg/script.h"
+#include "scripts.h"
+
+#define LOG_MAX 32
+
+typedef struct Output {
+	unsigned long t;
+	unsigned char target;
+	int value;
+} Output;
+
+Output outputs[LOG_MAX];
+unsigned char nOutputs = 0;
+int sensors[4];
+unsigned long now;
+int failures = 0;
+
+void output(unsigned char target, int value) {
+	if(nOutputs < LOG_MAX) {
+		outputs[nOutputs].t = now;
+		outputs[nOutputs].target = target;
+		outputs[nOutputs].value = value;
+	}
+	nOutputs++;
+}
+
+int input(unsigned char channel) {
+	return channel < 4 ? sensors[channel] : 0;
+}
+
+void check(int ok, char* what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if(!ok)
+		failures++;
+}
+
+// true if output n set target to value at time t
+int was(unsigned char n, unsigned long t, unsigned char target, int value) {
+	return n < nOutputs && outputs[n].t == t && outputs[n].target == target && outputs[n].value == value;
+}
+
+void load(unsigned char slot, const unsigned char* bytes, unsigned char n) {
+	script_write(slot, 0, (unsigned char*)bytes, n);
+	script_start(slot);
+	nOutputs = 0;
+	now = 0;
+}
+
+void test_pulse() {
+	load(0, script_pulse, script_pulse_size);
+	for(; now <= 4000; now++)
+		script_run(now);
+	check(nOutputs == 7, "pulse sets the servo 7 times");
+	check(was(0, 0, 1, 80) && was(1, 1500, 1, 80) && was(2, 1800, 1, 50), "pulse burns for 1500 ms before pulsing");
+	check(was(5, 2700, 1, 80) && was(6, 3000, 1, 50), "pulse loops three times with count and djnz");
+	check(script_state() == SCRIPT_IDLE && script_pc() == script_pulse_size, "pulse ends at its last byte");
+
+	// paused 100 ms into a 300 ms wait for a second, the wait goes on where it left off
+	load(0, script_pulse, script_pulse_size);
+	for(; now <= 4000; now++) {
+		if(now == 1600)
+			script_pause(now);
+		if(now == 2600)
+			script_resume(now);
+		script_run(now);
+	}
+	check(was(2, 2800, 1, 50), "a paused wait resumes with the time it had left");
+}
+
+void test_threshold() {
+	load(1, script_threshold, script_threshold_size);
+	sensors[0] = 700;
+	sensors[1] = -30;
+	for(; now <= 1000; now++) {
+		if(now == 250)
+			sensors[1] = 0;
+		if(now == 550)
+			sensors[0] = 500;
+		script_run(now);
+	}
+	check(was(0, 0, 1, 80) && was(2, 200, 1, 80) && was(3, 300, 1, 50), "iflt compares with a negative value");
+	check(was(4, 300, 2, 100) && was(6, 500, 2, 100) && nOutputs == 7, "ifgt loops while the sensor reads above");
+	check(script_state() == SCRIPT_IDLE, "threshold ends once the sensor drops");
+}
+
+int main() {
+	script_set_output_function(output);
+	script_set_input_function(input);
+	test_pulse();
+	test_threshold();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+// Host stand-in for <avr/eeprom.h>, EEMEM variables live in RAM and are read and written directly
+#ifndef __TEST_AVR_EEPROM__
+#define __TEST_AVR_EEPROM__
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t* p) { return *p; }
+static inline void eeprom_write_byte(uint8_t* p, uint8_t value) { *p = value; }
+static inline void eeprom_update_byte(uint8_t* p, uint8_t value) { *p = value; }
+static inline void eeprom_read_block(void* dst, const void* src, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_update_block(const void* src, void* dst, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_write_block(const void* src, void* dst, size_t n) { memcpy(dst, src, n); }
+static inline uint8_t eeprom_is_ready() { return 1; }
+static inline void eeprom_busy_wait() {}
+
+#endif
@@ -0,0 +1,9 @@
+// Host stand-in for <avr/io.h>, the registers the tested modules touch are plain variables
+#ifndef __TEST_AVR_IO__
+#define __TEST_AVR_IO__
+
+#include <stdint.h>
+
+volatile uint8_t SREG;
+
+#endif
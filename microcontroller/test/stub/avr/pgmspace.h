@@ -0,0 +1,17 @@
+// Host stand-in for <avr/pgmspace.h>, flash is ordinary memory
+#ifndef __TEST_AVR_PGMSPACE__
+#define __TEST_AVR_PGMSPACE__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define printf_P printf
+
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for <util/crc16.h>, the same CRC16 (polynomial 0xA001) done bit by bit
+#ifndef __TEST_UTIL_CRC16__
+#define __TEST_UTIL_CRC16__
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+	int i;
+	crc ^= a;
+	for(i = 0; i < 8; i++)
+		crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	return crc;
+}
+
+#endif
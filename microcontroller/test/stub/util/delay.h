@@ -0,0 +1,8 @@
+// Host stand-in for <util/delay.h>, nothing to wait for
+#ifndef __TEST_UTIL_DELAY__
+#define __TEST_UTIL_DELAY__
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
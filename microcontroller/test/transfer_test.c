@@ -0,0 +1,295 @@
+ /**
+  * File:   transfer_test.c
+  *
+  * Description:
+  * 	Host test of the flight recorder download, aatg/recorder.h and aatg/transfer.h.
+  * 	A child process plays the controller on the slave side of a pty: it logs to a RAM recorder
+  * 	that has wrapped, answers D0/D2/D3/D4 like main.c and runs the transfer from its loop.
+  * 	The parent downloads over the master side like www/js/logdownload.js, drops chunks on
+  * 	purpose, goes quiet for a while and resumes, and checks what it got against the snapshot
+  * 	as the controller took it, which the child passes back through a pipe.
+  * 	Time runs SPEEDUP times faster than the wall clock so a download takes about a second.
+  *
+  * Usage:
+  * 	make test, prints a line per check and exits with 1 if any failed.
+  */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define RECORDER_RAM_SIZE 768
+#include "../aatg/recorder.h"
+#include "../aatg/transfer.h"
+
+#define SPEEDUP 10				// simulated ms per wall clock ms
+#define RECORD_MS 50			// fast, so the log moves on while a download runs
+#define VALUES 6				// recordChannels in main.c
+#define CHUNKS (RECORDER_RAM_SIZE / TRANSFER_CHUNK)
+#define RESUME_MS 3000			// logdownload.resumeAfter
+#define DROP_EVERY 16			// chunks dropped on first arrival, as if corrupted
+#define PAUSE_AT 40				// chunk at which the host goes quiet
+#define PAUSE_MS 3500			// longer than a window timeout, shorter than the transfer giving up
+
+int failures = 0;
+
+void check(int ok, char* what) {
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if(!ok)
+		failures++;
+}
+
+unsigned long millis() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec*1000UL + t.tv_nsec/1000000) * SPEEDUP;
+}
+
+//
+// the controller
+//
+
+void record(unsigned long now) {
+	int values[VALUES];
+	unsigned char i;
+	for(i = 0; i < VALUES; i++)
+		values[i] = (now / RECORD_MS * (i+1) * 7) % 600 - 300;
+	recorder_log(now, values, VALUES);
+}
+
+// passes the snapshot just taken to the host: its size, then its bytes
+void send_snapshot(int pipe) {
+	unsigned int size = recorder_snapshot_size(), addr;
+	unsigned char b;
+	write(pipe, &size, sizeof(size));
+	for(addr = 0; addr < size; addr++) {
+		b = recorder_snapshot_read(addr);
+		write(pipe, &b, 1);
+	}
+}
+
+void controller(char* tty, int pipe) {
+	char line[32], c;
+	unsigned char n = 0;
+	int in, command, value;
+	unsigned long now, t, lastRecord = 0;
+
+	in = open(tty, O_RDONLY | O_NONBLOCK);
+	dup2(open(tty, O_WRONLY), 1);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	// a log that has wrapped a few times, so every block is in use
+	recorder_init(&recorder_ram);
+	now = millis();
+	for(t = now - 40000; t < now; t += RECORD_MS) {
+		record(t);
+		while(!recorder_idle())
+			recorder_run();
+	}
+
+	while(1) {
+		now = millis();
+		while(read(in, &c, 1) == 1) {
+			if(c != ' ' && n < sizeof(line) - 1) {
+				line[n++] = c;
+				continue;
+			}
+			line[n] = 0;
+			n = 0;
+			if(line[0] == 'Q')
+				_exit(0);
+			if(sscanf(line, "D%d:%d", &command, &value) != 2)
+				continue;
+			switch(command) {
+				case 0:
+					recorder_describe();
+					break;
+				case 2: // as in main.c
+					if(value == 0 || !recorder_snapshot_size()) {
+						recorder_snapshot();
+						send_snapshot(pipe);
+						value = 0;
+					}
+					transfer_start(recorder_snapshot_read, recorder_snapshot_size(), value, now);
+					printf("D2:%u,%d,%d\n", transfer_chunks(), TRANSFER_CHUNK, value);
+					break;
+				case 3:
+					transfer_ack(value, now);
+					break;
+				case 4:
+					transfer_stop();
+					break;
+			}
+		}
+		if(now - lastRecord >= RECORD_MS) {
+			lastRecord = now;
+			record(now);
+		}
+		recorder_run();
+		transfer_run(now);
+		if(!transfer_active())
+			recorder_release();
+		usleep(100);
+	}
+}
+
+//
+// the host
+//
+
+int master, snapshots;
+char pending[512];
+unsigned int nPending = 0;
+unsigned char expected[RECORDER_RAM_SIZE];	// the snapshot as the controller took it
+unsigned int expectedSize = 0;
+unsigned char data[RECORDER_RAM_SIZE];		// what was downloaded
+unsigned char got[CHUNKS];
+unsigned char dropped[CHUNKS];
+int total = -1, first = -1;
+unsigned int next = 0;
+
+// waits up to ms for a line from the controller
+int host_line(char* line, unsigned long ms) {
+	unsigned long until = millis() + ms;
+	struct pollfd p = {master, POLLIN, 0};
+	char* end;
+	int n;
+	while(1) {
+		if((end = memchr(pending, '\n', nPending))) {
+			n = end - pending;
+			memcpy(line, pending, n);
+			line[n] = 0;
+			nPending -= n + 1;
+			memmove(pending, end + 1, nPending);
+			return 1;
+		}
+		if(millis() >= until)
+			return 0;
+		if(poll(&p, 1, 1) > 0 && (n = read(master, pending + nPending, sizeof(pending) - nPending)) > 0)
+			nPending += n;
+	}
+}
+
+void host_send(int command, int value) {
+	char s[16];
+	write(master, s, sprintf(s, "D%d:%d ", command, value));
+}
+
+void read_snapshot() {
+	unsigned int i;
+	read(snapshots, &expectedSize, sizeof(expectedSize));
+	for(i = 0; i < expectedSize; i++)
+		read(snapshots, &expected[i], 1);
+}
+
+// sends D2:<from> and waits for the answer, a restart drops what came before it like logdownload.js
+int request(unsigned int from) {
+	char line[128];
+	unsigned int chunks, size;
+	host_send(2, from);
+	while(host_line(line, RESUME_MS))
+		if(sscanf(line, "D2:%u,%u,%d", &chunks, &size, &first) == 3) {
+			total = chunks;
+			if(first == 0)
+				read_snapshot();
+			if(first < next) {
+				memset(got + first, 0, CHUNKS - first);
+				next = first;
+			}
+			return 1;
+		}
+	return 0;
+}
+
+// takes D5 lines until every chunk is in, returns 1 when the controller confirmed the end
+int download(int drop, int pause) {
+	char line[128], hex[2*TRANSFER_CHUNK + 1];
+	unsigned int seq, crc, c, i, b, n;
+	while(1) {
+		if(!host_line(line, RESUME_MS)) {
+			request(next);
+			continue;
+		}
+		if(sscanf(line, "D3:%u", &n) == 1)
+			return n == total && next == total;
+		if(sscanf(line, "D5:%u,%16[0-9a-f],%x", &seq, hex, &crc) != 3 || seq >= CHUNKS)
+			continue;
+		n = strlen(hex) / 2;
+		c = _crc16_update(_crc16_update(0xFFFF, seq), seq >> 8);
+		for(i = 0; i < n; i++) {
+			sscanf(hex + 2*i, "%2x", &b);
+			data[seq*TRANSFER_CHUNK + i] = b;
+			c = _crc16_update(c, b);
+		}
+		if(c != crc)
+			continue;
+		if(drop && seq % DROP_EVERY == DROP_EVERY/2 && !dropped[seq]) {
+			dropped[seq] = 1;
+			continue;
+		}
+		if(pause && seq == PAUSE_AT) {
+			pause = 0;
+			usleep(PAUSE_MS * 1000 / SPEEDUP);
+			request(next);
+			check(first == next, "a resume before the transfer gives up continues where it stopped");
+			continue;
+		}
+		got[seq] = 1;
+		while(next < total && got[next])
+			next++;
+		host_send(3, next);
+	}
+}
+
+int main() {
+	int fds[2], status, blocks, head, records, lost = 0, slave;
+	unsigned int seq;
+	char line[128];
+	struct termios raw;
+	pid_t child;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	grantpt(master);
+	unlockpt(master);
+	// raw before the controller runs, nothing echoed or held back for a newline
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+	pipe(fds);
+	snapshots = fds[0];
+	child = fork();
+	if(child == 0) {
+		controller(ptsname(master), fds[1]);
+	}
+
+	request(0);
+	check(first == 0 && total == CHUNKS && expectedSize == RECORDER_RAM_SIZE, "D2:0 snapshots the whole wrapped log");
+	check(download(1, 1), "the download completes with dropped chunks and a pause");
+	check(next == total && !memcmp(data, expected, expectedSize), "the download matches the log as it was at the snapshot");
+
+	host_send(0, 0);
+	while(host_line(line, 1000) && sscanf(line, "D0:%d,%d,%u,%d,%d", &blocks, &head, &seq, &records, &lost) != 5);
+	check(lost > 0, "records are dropped while every block is held for the download");
+
+	// done and released, the log goes on over the old snapshot while the host is away
+	usleep(2000 * 1000 / SPEEDUP);
+	next = 5;
+	request(next);
+	check(first == 0, "a resume after the log moved on starts over from a fresh snapshot");
+	check(download(0, 0), "the fresh download completes");
+	check(!memcmp(data, expected, expectedSize), "the fresh download matches its snapshot");
+
+	write(master, "Q ", 2);
+	waitpid(child, &status, 0);
+	return failures ? 1 : 0;
+}
@@ -6,6 +6,7 @@ var app = {
     enviroment: false,
 
     conTLoop: undefined,
+    linkTLoop: undefined,
     // Application Constructor
     initialize: function () {
         app.bindEvents();
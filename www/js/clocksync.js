@@ -0,0 +1,67 @@
+// Maps the controller's millisecond clock to host time (see the E1 command in microcontroller/main.c)
+//
+// Each echo gives four timestamps, as in NTP:
+//     t1 host sends, t2 device receives, t3 device answers, t4 host receives
+//     offset = ((t2 - t1) + (t3 - t4)) / 2    device clock minus host clock
+//     delay  = (t4 - t1) - (t3 - t2)          time spent on the link
+// Bluetooth buffering makes the delay vary by hundreds of ms, and an echo's offset error
+// is at most half its delay, so only echoes with close to the smallest delay seen are used.
+// Drift between the two crystals is the slope of a least squares line through their offsets.
+var clocksync = {
+    samples: [],
+    maxSamples: 64,
+    delayMargin: 10, // ms above the smallest delay an echo may have and still be used
+    offset: undefined, // device - host at time ref
+    drift: 0,          // change of offset per host ms
+    ref: 0,
+
+    // Adds an echo, t1 and t4 in host ms, t2 and t3 in device ms
+    add: function (t1, t2, t3, t4) {
+        var delay = (t4 - t1) - (t3 - t2);
+        if(delay < 0)
+            return;
+        if(clocksync.offset !== undefined && Math.abs(clocksync.predict(t1) - ((t2 - t1) + (t3 - t4)) / 2) > 1000)
+            clocksync.reset(); // the controller restarted its clock
+        clocksync.samples.push({ host: (t1 + t4) / 2, offset: ((t2 - t1) + (t3 - t4)) / 2, delay: delay });
+        if(clocksync.samples.length > clocksync.maxSamples)
+            clocksync.samples.shift();
+        clocksync.fit();
+    },
+    fit: function () {
+        var minDelay = Math.min.apply(null, clocksync.samples.map(function(s) { return s.delay; }));
+        var good = clocksync.samples.filter(function(s) { return s.delay <= minDelay + clocksync.delayMargin; });
+        var n = good.length;
+        var ref = good[n-1].host;
+        var sx = 0, sy = 0, sxx = 0, sxy = 0;
+        good.forEach(function(s) {
+            var x = s.host - ref;
+            sx += x; sy += s.offset; sxx += x*x; sxy += x*s.offset;
+        });
+        var d = n*sxx - sx*sx;
+        clocksync.drift = n > 2 && d > 0 ? (n*sxy - sx*sy) / d : 0;
+        clocksync.offset = (sy - clocksync.drift*sx) / n;
+        clocksync.ref = ref;
+    },
+    // Estimated offset at host time host
+    predict: function (host) {
+        return clocksync.offset + clocksync.drift*(host - clocksync.ref);
+    },
+    // Smallest delay seen, the error bound of the offset is about half of it
+    error: function () {
+        if(!clocksync.samples.length)
+            return undefined;
+        return Math.min.apply(null, clocksync.samples.map(function(s) { return s.delay; })) / 2;
+    },
+    // Host time in ms of a device timestamp, undefined until the first echo
+    toHost: function (device) {
+        if(clocksync.offset === undefined)
+            return undefined;
+        // the offset depends on the host time, one step is plenty as drift is a few ppm
+        return device - clocksync.predict(device - clocksync.offset);
+    },
+    reset: function () {
+        clocksync.samples = [];
+        clocksync.offset = undefined;
+        clocksync.drift = 0;
+    }
+};
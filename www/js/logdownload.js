@@ -0,0 +1,141 @@
+// Downloads the controller's flight recorder log (see microcontroller/aatg/transfer.h and recorder.h)
+//
+//     logdownload.write = send; // how commands reach the controller, e.g. with a node address
+//     logdownload.start(function(records) { ... }, function(received, total) { ... });
+//     // and pass every line from the controller to logdownload.handle(line) first
+//
+// Chunks are checked against their CRC and acknowledged with "D3:<next missing chunk>".
+// If no chunk arrives for resumeAfter ms, e.g. because the link dropped, the download
+// is resumed at the first missing chunk, so nothing already received is fetched again,
+// unless the controller answers that it starts over.
+var logdownload = {
+    channels: ['T1', 'T2', 'D1', 'P1', 'S1', 'S2'], // recordChannels in main.c
+    blockSize: 64,
+    blockHeader: 7,
+    resumeAfter: 3000,
+    write: function (frame) { bluetoothSerial.write(frame); },
+
+    chunks: [],
+    total: undefined,
+    next: 0,
+    lastHeard: 0,
+    timer: undefined,
+    done: undefined,
+    progress: undefined,
+
+    start: function (done, progress) {
+        logdownload.chunks = [];
+        logdownload.total = undefined;
+        logdownload.next = 0;
+        logdownload.done = done;
+        logdownload.progress = progress;
+        logdownload.lastHeard = Date.now();
+        clearInterval(logdownload.timer);
+        logdownload.timer = setInterval(function() {
+            if(Date.now() - logdownload.lastHeard > logdownload.resumeAfter) {
+                logdownload.lastHeard = Date.now();
+                logdownload.write("D2:" + logdownload.next + " ");
+            }
+        }, 500);
+        logdownload.write("D2:0 ");
+    },
+    stop: function () {
+        clearInterval(logdownload.timer);
+        logdownload.timer = undefined;
+        logdownload.write("D4:0 ");
+    },
+    // Returns true if the line belonged to the download
+    handle: function (line) {
+        if(logdownload.timer === undefined)
+            return false;
+        var header = /^D2:(\d+),(\d+)(?:,(\d+))?/.exec(line);
+        if(header) {
+            logdownload.total = parseInt(header[1], 10);
+            var first = header[3] === undefined ? logdownload.next : parseInt(header[3], 10);
+            if(first < logdownload.next) {
+                // the log changed while the link was down, what was received belongs to an older snapshot
+                logdownload.chunks = logdownload.chunks.slice(0, first);
+                logdownload.next = first;
+            }
+            logdownload.lastHeard = Date.now();
+            logdownload.finishIfComplete();
+            return true;
+        }
+        var chunk = /^D5:(\d+),([0-9a-f]*),([0-9a-f]{4})/.exec(line);
+        if(chunk) {
+            var seq = parseInt(chunk[1], 10);
+            var bytes = [];
+            for(var i = 0; i < chunk[2].length; i += 2)
+                bytes.push(parseInt(chunk[2].substr(i, 2), 16));
+            if(logdownload.crc16([seq & 0xFF, seq >> 8].concat(bytes)) != parseInt(chunk[3], 16))
+                return true; // corrupt, the controller sends it again when the window times out
+            logdownload.lastHeard = Date.now();
+            logdownload.chunks[seq] = bytes;
+            while(logdownload.chunks[logdownload.next] !== undefined)
+                logdownload.next++;
+            logdownload.write("D3:" + logdownload.next + " ");
+            if(logdownload.progress)
+                logdownload.progress(logdownload.next, logdownload.total);
+            logdownload.finishIfComplete();
+            return true;
+        }
+        return /^D3:\d+/.test(line); // the controller confirming the end
+    },
+    finishIfComplete: function () {
+        if(logdownload.total === undefined || logdownload.next < logdownload.total)
+            return;
+        clearInterval(logdownload.timer);
+        logdownload.timer = undefined;
+        var bytes = [].concat.apply([], logdownload.chunks.slice(0, logdownload.total));
+        if(logdownload.done)
+            logdownload.done(logdownload.decode(bytes));
+    },
+    // CRC16 as avr-libc's _crc16_update, starting at 0xFFFF
+    crc16: function (bytes) {
+        var crc = 0xFFFF;
+        bytes.forEach(function(b) {
+            crc ^= b;
+            for(var i = 0; i < 8; i++)
+                crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        });
+        return crc;
+    },
+    // Turns recorder blocks, oldest first, into [{ time: device ms, seq: block, T1: value, ... }]
+    // Records are zigzag varint deltas, the first in each block a keyframe, see recorder.h
+    decode: function (bytes) {
+        var records = [];
+        for(var block = 0; block + logdownload.blockSize <= bytes.length; block += logdownload.blockSize) {
+            var seq = bytes[block] | bytes[block+1] << 8;
+            var used = bytes[block+2];
+            if(seq == 0xFFFF || used > logdownload.blockSize - logdownload.blockHeader)
+                continue;
+            var time = (bytes[block+3] | bytes[block+4] << 8 | bytes[block+5] << 16) + bytes[block+6] * 0x1000000;
+            var r = block + logdownload.blockHeader;
+            var end = r + used;
+            var varint = function() {
+                var v = 0, shift = 0;
+                do {
+                    v |= (bytes[r] & 0x7F) << shift;
+                    shift += 7;
+                } while(bytes[r++] & 0x80 && r < end);
+                return v;
+            };
+            var zigzag = function() { var z = varint(); return (z >>> 1) ^ -(z & 1); };
+            var last = undefined;
+            var dt = 0;
+            while(r < end) {
+                dt = (dt + zigzag()) & 0xFFFF; // unsigned 16 bit like the controller, the keyframe's is 0
+                time += dt;
+                var record = { time: time, seq: seq };
+                logdownload.channels.forEach(function(name) {
+                    var v = zigzag();
+                    v = last ? last[name] + v : v;
+                    record[name] = ((v + 0x8000) & 0xFFFF) - 0x8000; // 16 bit like the controller
+                });
+                records.push(record);
+                last = record;
+            }
+        }
+        return records;
+    }
+};
@@ -0,0 +1,125 @@
+// Assembler for the controller's EEPROM macro scripts (see microcontroller/aatg/script.h)
+//
+// One instruction per line, labels end with ':' and comments start with ';'
+//
+//     set S1 80         ; servo setpoint
+//     wait 1500         ; milliseconds
+//     count 3
+// pulse:
+//     set S1 80
+//     wait 300
+//     set S1 50
+//     wait 300
+//     djnz pulse        ; repeat until the counter reaches zero
+//     iflt T1 500 pulse ; jump while T1 reads below 500
+//     end
+var scriptasm = {
+    // operand kinds: b = byte, w = 16 bit word, v = signed 16 bit value, a = address/label, s = servo, c = sensor channel
+    opcodes: {
+        end:   [0],
+        set:   [1, 's', 'b'],
+        wait:  [2, 'w'],
+        jump:  [3, 'a'],
+        iflt:  [4, 'c', 'v', 'a'],
+        ifgt:  [5, 'c', 'v', 'a'],
+        count: [6, 'b'],
+        djnz:  [7, 'a']
+    },
+    // operand ranges, sensor values are compared as signed ints on the controller
+    ranges: { w: [0, 0xFFFF], v: [-32768, 32767] },
+    channels: { T1: 0, T2: 1, D1: 2, P1: 3 },
+    slotSize: 32,
+    chunkSize: 16,
+    uploadDelay: 200, // ms between chunks, leaves time for the EEPROM writes
+
+    // Returns the script as an array of bytes, throws on errors
+    assemble: function (source) {
+        var lines = source.split('\n');
+        var labels = {};
+        var program = [];
+        var addr = 0;
+        var i, j, line, words, op;
+
+        // first pass: strip comments, record labels and instruction addresses
+        for(i = 0; i < lines.length; i++) {
+            line = lines[i].replace(/;.*$/, '').trim();
+            var label = /^(\w+):\s*(.*)$/.exec(line);
+            if(label) {
+                labels[label[1]] = addr;
+                line = label[2];
+            }
+            if(line == '')
+                continue;
+            words = line.split(/\s+/);
+            op = scriptasm.opcodes[words[0].toLowerCase()];
+            if(!op)
+                throw new Error("line " + (i+1) + ": unknown instruction '" + words[0] + "'");
+            if(words.length != op.length)
+                throw new Error("line " + (i+1) + ": '" + words[0] + "' takes " + (op.length-1) + " operands");
+            program.push({ line: i+1, op: op, args: words.slice(1) });
+            addr += 1 + op.slice(1).reduce(function(n, kind) { return n + (kind == 'w' || kind == 'v' ? 2 : 1); }, 0);
+        }
+        if(addr > scriptasm.slotSize)
+            throw new Error("script is " + addr + " bytes, a slot holds " + scriptasm.slotSize);
+
+        // second pass: encode
+        var bytes = [];
+        for(i = 0; i < program.length; i++) {
+            op = program[i].op;
+            bytes.push(op[0]);
+            for(j = 1; j < op.length; j++) {
+                var arg = program[i].args[j-1];
+                var val;
+                switch(op[j]) {
+                    case 'a':
+                        val = arg in labels ? labels[arg] : parseInt(arg, 10);
+                        break;
+                    case 's':
+                        val = parseInt(arg.replace(/^S/i, ''), 10);
+                        break;
+                    case 'c':
+                        val = arg.toUpperCase() in scriptasm.channels ? scriptasm.channels[arg.toUpperCase()] : parseInt(arg, 10);
+                        break;
+                    default:
+                        val = parseInt(arg, 10);
+                }
+                var range = scriptasm.ranges[op[j]] || [0, 0xFF];
+                if(isNaN(val) || val < range[0] || val > range[1])
+                    throw new Error("line " + program[i].line + ": bad operand '" + arg + "'");
+                bytes.push(val & 0xFF);
+                if(op[j] == 'w' || op[j] == 'v')
+                    bytes.push((val >> 8) & 0xFF); // two's complement for negative values
+            }
+        }
+        return bytes;
+    },
+    // Splits a script into the upload commands for a slot
+    toCommands: function (slot, bytes) {
+        var commands = [];
+        for(var offset = 0; offset < bytes.length; offset += scriptasm.chunkSize) {
+            var hex = bytes.slice(offset, offset + scriptasm.chunkSize).map(function(b) {
+                return (b < 16 ? '0' : '') + b.toString(16);
+            }).join('');
+            commands.push("W" + slot + ":" + offset + "," + hex + " ");
+        }
+        return commands;
+    },
+    // Assembles and uploads a script, the controller acknowledges each chunk with "W<slot>:<offset>,<length>"
+    upload: function (slot, source, done) {
+        var commands = scriptasm.toCommands(slot, scriptasm.assemble(source));
+        var next = function() {
+            if(!commands.length) {
+                if(done)
+                    done();
+                return;
+            }
+            bluetoothSerial.write(commands.shift());
+            window.setTimeout(next, scriptasm.uploadDelay);
+        };
+        next();
+    },
+    start:  function (slot) { bluetoothSerial.write("X" + slot + ":1 "); },
+    abort:  function (slot) { bluetoothSerial.write("X" + slot + ":0 "); },
+    pause:  function (slot) { bluetoothSerial.write("X" + slot + ":2 "); },
+    resume: function (slot) { bluetoothSerial.write("X" + slot + ":3 "); }
+};